@@ -17,7 +17,6 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/init.h>
-#include <linux/hashtable.h>
 #include <linux/uaccess.h>
 #include <linux/sizes.h>
 #include <linux/random.h>
@@ -48,15 +47,14 @@ bool kdbus_bus_uid_is_privileged(const struct kdbus_bus *bus)
  */
 struct kdbus_bus *kdbus_bus_ref(struct kdbus_bus *bus)
 {
-	kref_get(&bus->kref);
+	percpu_ref_get(&bus->ref);
 	return bus;
 }
 
-static void __kdbus_bus_free(struct kref *kref)
+static void __kdbus_bus_free(struct work_struct *work)
 {
-	struct kdbus_bus *bus = container_of(kref, struct kdbus_bus, kref);
+	struct kdbus_bus *bus = container_of(work, struct kdbus_bus, free_work);
 
-	kdbus_bus_disconnect(bus);
 	if (bus->name_registry)
 		kdbus_name_registry_free(bus->name_registry);
 	kdbus_ns_unref(bus->ns);
@@ -64,12 +62,21 @@ static void __kdbus_bus_free(struct kref *kref)
 	kfree(bus);
 }
 
+/* the last put may happen in RCU callback context, free from a worker */
+static void kdbus_bus_release(struct percpu_ref *ref)
+{
+	struct kdbus_bus *bus = container_of(ref, struct kdbus_bus, ref);
+
+	schedule_work(&bus->free_work);
+}
+
 /**
  * kdbus_bus_unref() - decrease the reference counter of a kdbus_bus
  * @bus:		The bus to unref
  *
  * Release a reference. If the reference count drops to 0, the bus will be
- * freed.
+ * freed. This can only happen after the bus is disconnected; until then,
+ * the references are counted per CPU.
  *
  * Returns: NULL
  */
@@ -78,7 +85,7 @@ struct kdbus_bus *kdbus_bus_unref(struct kdbus_bus *bus)
 	if (!bus)
 		return NULL;
 
-	kref_put(&bus->kref, __kdbus_bus_free);
+	percpu_ref_put(&bus->ref);
 	return NULL;
 }
 
@@ -91,19 +98,69 @@ struct kdbus_bus *kdbus_bus_unref(struct kdbus_bus *bus)
  * is ref'ed, and needs to be unref'ed by the user. Returns NULL if
  * the connection can't be found.
  *
- * This function must be called with bus->lock held.
+ * The lookup does not take any lock; a connection whose last reference
+ * is already gone is not returned, even if it is still in the map. The
+ * memory of connections is freed only after an RCU grace period.
  */
 struct kdbus_conn *kdbus_bus_find_conn_by_id(struct kdbus_bus *bus, u64 id)
 {
-	struct kdbus_conn *conn, *found = NULL;
+	struct kdbus_conn *conn;
+
+	/* the tree is indexed by unsigned long, see kdbus_conn_new() */
+	if (id > ULONG_MAX)
+		return NULL;
 
-	hash_for_each_possible(bus->conn_hash, conn, hentry, id)
-		if (conn->id == id) {
-			found = kdbus_conn_ref(conn);
-			break;
+	rcu_read_lock();
+	conn = radix_tree_lookup(&bus->conn_tree, id);
+	if (conn && !percpu_ref_tryget(&conn->ref))
+		conn = NULL;
+	rcu_read_unlock();
+
+	return conn;
+}
+
+/* number of connections pinned at a time during the teardown of a bus */
+#define KDBUS_BUS_TEARDOWN_BATCH	64
+
+/*
+ * Disconnect all connections of a dead bus. The connections are pinned
+ * in batches under conn_lock and torn down without it; a connection
+ * which disconnects on its own meanwhile just drops out of the tree.
+ * Every batch continues behind the last ID looked at, a connection
+ * which another thread is still tearing down is not visited again.
+ */
+static void kdbus_bus_conns_disconnect(struct kdbus_bus *bus)
+{
+	struct kdbus_conn *conns[KDBUS_BUS_TEARDOWN_BATCH];
+	struct radix_tree_iter iter;
+	unsigned long next = 0;
+	unsigned int i, n;
+	void **slot;
+
+	do {
+		n = 0;
+
+		mutex_lock(&bus->conn_lock);
+		radix_tree_for_each_slot(slot, &bus->conn_tree, &iter, next) {
+			struct kdbus_conn *conn = kdbus_bus_conn_slot(bus, slot);
+
+			next = iter.index + 1;
+			if (!percpu_ref_tryget(&conn->ref))
+				continue;
+
+			conns[n++] = conn;
+			if (n == ARRAY_SIZE(conns))
+				break;
 		}
+		mutex_unlock(&bus->conn_lock);
 
-	return found;
+		for (i = 0; i < n; i++) {
+			kdbus_conn_disconnect(conns[i]);
+			kdbus_conn_unref(conns[i]);
+		}
+
+		cond_resched();
+	} while (n == ARRAY_SIZE(conns) && next != 0);
 }
 
 /**
@@ -111,25 +168,27 @@ struct kdbus_conn *kdbus_bus_find_conn_by_id(struct kdbus_bus *bus, u64 id)
  * @bus:		The kdbus reference
  *
  * The passed bus will be disconnected and the associated endpoint will be
- * unref'ed.
+ * unref'ed. All its connections are disconnected as well; as the bus is
+ * marked dead before, they do not notify each other about going away.
  */
 void kdbus_bus_disconnect(struct kdbus_bus *bus)
 {
 	struct kdbus_ep *ep, *tmp;
 
-	mutex_lock(&bus->lock);
-	if (bus->disconnected) {
-		mutex_unlock(&bus->lock);
+	if (atomic_xchg(&bus->disconnected, 1))
 		return;
-	}
 
-	bus->disconnected = true;
-	mutex_unlock(&bus->lock);
+	/*
+	 * Switch to the shared atomic counter, which can tell when the
+	 * last reference is gone. The reference dropped by the kill is
+	 * replaced, the users still hold theirs.
+	 */
+	percpu_ref_get(&bus->ref);
+	percpu_ref_kill(&bus->ref);
 
 	/* disconnect from namespace */
 	mutex_lock(&bus->ns->lock);
-	if (bus->ns)
-		list_del(&bus->ns_entry);
+	list_del(&bus->ns_entry);
 	mutex_unlock(&bus->ns->lock);
 
 	/* remove all endpoints attached to this bus */
@@ -137,6 +196,8 @@ void kdbus_bus_disconnect(struct kdbus_bus *bus)
 		kdbus_ep_disconnect(ep);
 		kdbus_ep_unref(ep);
 	}
+
+	kdbus_bus_conns_disconnect(bus);
 }
 
 static struct kdbus_bus *kdbus_bus_find(struct kdbus_ns *ns, const char *name)
@@ -196,14 +257,24 @@ int kdbus_bus_new(struct kdbus_ns *ns,
 	if (!b)
 		return -ENOMEM;
 
-	kref_init(&b->kref);
+	ret = percpu_ref_init(&b->ref, kdbus_bus_release);
+	if (ret < 0) {
+		kfree(b);
+		return ret;
+	}
+
+	INIT_WORK(&b->free_work, __kdbus_bus_free);
+	INIT_LIST_HEAD(&b->ns_entry);
+	b->ns = kdbus_ns_ref(ns);
 	b->uid_owner = uid;
 	b->bus_flags = bus_make->flags;
 	b->bloom_size = bus_make->bloom_size;
-	b->conn_id_next = 1; /* connection 0 == kernel */
+	atomic64_set(&b->conn_id_next, 0); /* connection 0 == kernel */
 	mutex_init(&b->lock);
-	hash_init(b->conn_hash);
+	mutex_init(&b->conn_lock);
+	INIT_RADIX_TREE(&b->conn_tree, GFP_KERNEL);
 	INIT_LIST_HEAD(&b->ep_list);
+	init_rwsem(&b->monitors_lock);
 	INIT_LIST_HEAD(&b->monitors_list);
 
 	/* generate unique ID for this bus */
@@ -223,7 +294,8 @@ int kdbus_bus_new(struct kdbus_ns *ns,
 		goto exit;
 	}
 
-	ret = kdbus_name_registry_new(&b->name_registry);
+	ret = kdbus_name_registry_new(&b->name_registry,
+				      b->bus_flags & KDBUS_MAKE_NAME_DIRECTORY);
 	if (ret < 0)
 		goto exit;
 
@@ -236,13 +308,13 @@ int kdbus_bus_new(struct kdbus_ns *ns,
 	mutex_lock(&ns->lock);
 	b->id = ns->bus_id_next++;
 	list_add_tail(&b->ns_entry, &ns->bus_list);
-	b->ns = kdbus_ns_ref(ns);
 	mutex_unlock(&ns->lock);
 
 	*bus = b;
 	return 0;
 
 exit:
+	kdbus_bus_disconnect(b);
 	kdbus_bus_unref(b);
 	return ret;
 }
@@ -14,29 +14,35 @@
 #define __KDBUS_BUS_H
 
 #include <linux/idr.h>
-#include <linux/hashtable.h>
+#include <linux/percpu-refcount.h>
+#include <linux/radix-tree.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
 
 #include "internal.h"
 
 /**
  * struct kdbus_bus - bus in a namespace
- * @kref:		Reference count
- * @disconnected:	Invalidated data
+ * @ref:		Reference count, per-CPU until the bus is disconnected
+ * @free_work:		Frees the bus after the last reference is gone
+ * @disconnected:	Invalidated data, read without taking @lock
  * @uid_owner:		The uid of the owner of the bus
  * @ns:			Namespace of this bus
  * @name:		The bus name
  * @id:			ID of this bus in the namespace
- * @lock:		Bus data lock
+ * @lock:		Bus data lock, protects the endpoints
  * @ep_id_next:		Next endpoint id sequence number
- * @conn_id_next:	Next connection id sequence number
+ * @conn_id_next:	Last allocated connection id
  * @msg_id_next:	Next message id sequence number
  * @conn_idr:		Map of connection device minor nummbers
- * @conn_hash:		Map of connection IDs
+ * @conn_lock:		Serializes changes to and walks over conn_tree
+ * @conn_tree:		Map of connection IDs, looked up under RCU
  * @ep_list:		Endpoints on this bus
  * @bus_flags:		Simple pass-through flags from userspace to userspace
  * @bloom_size:		Bloom filter size
  * @name_registry:	Namespace's list of buses
  * @ns_entry:		Namespace's list of buses
+ * @monitors_lock:	Protects monitors_list
  * @monitors_list:	Connections that monitor this bus
  * @id128:		Unique random 128 bit ID of this bus
  *
@@ -47,23 +53,26 @@
  * the bus.
  */
 struct kdbus_bus {
-	struct kref kref;
-	bool disconnected;
+	struct percpu_ref ref;
+	struct work_struct free_work;
+	atomic_t disconnected;
 	kuid_t uid_owner;
 	struct kdbus_ns *ns;
 	const char *name;
 	u64 id;
 	struct mutex lock;
 	u64 ep_id_next;
-	u64 conn_id_next;
+	atomic64_t conn_id_next;
 	u64 msg_id_next;
 	struct idr conn_idr;
-	DECLARE_HASHTABLE(conn_hash, 6);
+	struct mutex conn_lock;
+	struct radix_tree_root conn_tree;
 	struct list_head ep_list;
 	u64 bus_flags;
 	size_t bloom_size;
 	struct kdbus_name_registry *name_registry;
 	struct list_head ns_entry;
+	struct rw_semaphore monitors_lock;
 	struct list_head monitors_list;
 	u8 id128[16];
 };
@@ -80,4 +89,19 @@ void kdbus_bus_disconnect(struct kdbus_bus *bus);
 bool kdbus_bus_uid_is_privileged(const struct kdbus_bus *bus);
 void kdbus_bus_scan_timeout_list(struct kdbus_bus *bus);
 struct kdbus_conn *kdbus_bus_find_conn_by_id(struct kdbus_bus *bus, u64 id);
+
+/*
+ * kdbus_bus_conn_slot() - the connection in a slot of bus->conn_tree
+ * @bus:		The bus
+ * @slot:		A slot returned by radix_tree_for_each_slot()
+ *
+ * The connections are iterated in the order of their IDs, which is also
+ * the order in which they were created. This must be called with
+ * bus->conn_lock held, which keeps the tree from changing.
+ */
+static inline struct kdbus_conn *kdbus_bus_conn_slot(struct kdbus_bus *bus,
+						     void **slot)
+{
+	return rcu_dereference_protected(*slot, lockdep_is_held(&bus->conn_lock));
+}
 #endif
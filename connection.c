@@ -21,10 +21,9 @@
 #include <linux/init.h>
 #include <linux/poll.h>
 #include <linux/file.h>
-#include <linux/hashtable.h>
 #include <linux/mm.h>
-#include <linux/syscalls.h>
 #include <linux/uio.h>
+#include <linux/vmalloc.h>
 
 #include "connection.h"
 #include "message.h"
@@ -37,6 +36,7 @@
 #include "names.h"
 #include "policy.h"
 #include "metadata.h"
+#include "ring.h"
 
 /**
  * struct kdbus_conn_queue - messages waiting to be read
@@ -73,6 +73,20 @@ struct kdbus_conn_queue {
 	bool expect_reply;
 };
 
+/**
+ * struct kdbus_conn_reply - room kept for the reply to a method call
+ * @entry:		Entry in the caller's reply_list
+ * @dst_id:		The ID of the connection which was called
+ * @cookie:		Cookie of the method call
+ * @deadline_ns:	Timeout of the method call, plus a grace period
+ */
+struct kdbus_conn_reply {
+	struct list_head entry;
+	u64 dst_id;
+	u64 cookie;
+	u64 deadline_ns;
+};
+
 static void kdbus_conn_fds_unref(struct kdbus_conn_queue *queue)
 {
 	unsigned int i;
@@ -137,65 +151,154 @@ static void kdbus_conn_memfds_unref(struct kdbus_conn_queue *queue)
 	queue->memfds_count = 0;
 }
 
-/* Validate the state of the incoming PAYLOAD_MEMFD, and grab a reference
- * to put it into the receiver's queue. */
-static int kdbus_conn_memfd_ref(const struct kdbus_item *item,
-				struct file **file)
+/*
+ * Copy the content of a small sealed memfd into the pool, and describe
+ * it with a PAYLOAD_OFF item in place of the PAYLOAD_MEMFD item; both
+ * items have the same size.
+ */
+static int kdbus_conn_memfd_inline(struct kdbus_conn *conn,
+				   const struct kdbus_item *item,
+				   struct file *fp, size_t off, size_t items,
+				   size_t vec_data)
 {
-	struct file *fp;
+	const size_t size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_vec);
+	char tmp[size];
+	struct kdbus_item *it = (struct kdbus_item *)tmp;
 	int ret;
 
-	fp = fget(item->memfd.fd);
-	if (!fp)
-		return -EBADF;
+	BUILD_BUG_ON(KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec)) !=
+		     KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd)));
 
-	/*
-	 * We only accept kdbus_memfd files as payload, other files need to
-	 * be passed with KDBUS_MSG_FDS.
-	 */
-	if (!kdbus_is_memfd(fp)) {
-		ret = -EMEDIUMTYPE;
-		goto exit_unref;
-	}
+	it->type = KDBUS_ITEM_PAYLOAD_OFF;
+	it->size = size;
+	it->vec.offset = off + vec_data;
+	it->vec.size = item->memfd.size;
+	ret = kdbus_pool_write(conn->pool, off + items, it, size);
+	if (ret < 0)
+		return ret;
 
-	/* We only accept a sealed memfd file whose content cannot be altered
-	 * by the sender or anybody else while it is shared or in-flight. */
-	if (!kdbus_is_memfd_sealed(fp)) {
-		ret = -ETXTBSY;
-		goto exit_unref;
-	}
+	ret = kdbus_pool_write_file(conn->pool, off + vec_data,
+				    kdbus_memfd_shmem(fp), 0,
+				    item->memfd.size);
 
-	/* The specified size in the item cannot be larger than the file. */
-	if (item->memfd.size > kdbus_memfd_size(fp)) {
-		ret = -EBADF;
-		goto exit_unref;
+	return ret < 0 ? ret : 0;
+}
+
+/* large vecs are passed in a memfd, if the receiver asked for it */
+static bool kdbus_conn_vec_is_memfd(const struct kdbus_conn *conn,
+				    const struct kdbus_item *item)
+{
+	return conn->vec_memfd_min > 0 &&
+	       KDBUS_PTR(item->vec.address) &&
+	       item->vec.size >= conn->vec_memfd_min;
+}
+
+static void kdbus_conn_vec_memfds_free(struct file **fps, unsigned int count)
+{
+	unsigned int i;
+
+	if (!fps)
+		return;
+
+	for (i = 0; i < count; i++)
+		if (fps[i])
+			fput(fps[i]);
+
+	kfree(fps);
+}
+
+/*
+ * Copy the data of all large PAYLOAD_VECs into new sealed memfds. This
+ * is done before the lock of the receiver is taken; the copy can be
+ * large, and fault in the memory of the sender.
+ */
+static int kdbus_conn_vec_memfds_new(const struct kdbus_conn *conn,
+				     const struct kdbus_kmsg *kmsg,
+				     unsigned int count, struct file ***fps)
+{
+	const struct kdbus_item *item;
+	unsigned int i = 0;
+	struct file **f;
+
+	f = kcalloc(count, sizeof(struct file *), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	KDBUS_ITEM_FOREACH(item, &kmsg->msg, items) {
+		struct file *fp;
+
+		if (item->type != KDBUS_ITEM_PAYLOAD_VEC ||
+		    !kdbus_conn_vec_is_memfd(conn, item))
+			continue;
+
+		fp = kdbus_memfd_new_from_user(KDBUS_PTR(item->vec.address),
+					       item->vec.size);
+		if (IS_ERR(fp)) {
+			kdbus_conn_vec_memfds_free(f, i);
+			return PTR_ERR(fp);
+		}
+
+		f[i++] = fp;
 	}
 
-	*file = fp;
+	*fps = f;
 	return 0;
+}
 
-exit_unref:
-	fput(fp);
-	return ret;
+/*
+ * Attach the memfd holding the data of a large PAYLOAD_VEC, and describe
+ * it with a PAYLOAD_MEMFD item in place of the PAYLOAD_VEC item; both
+ * items have the same size. On success, the queue owns the file.
+ */
+static int kdbus_conn_vec_memfd(struct kdbus_conn *conn,
+				struct kdbus_conn_queue *queue,
+				const struct kdbus_item *item,
+				struct file *fp, size_t off, size_t items)
+{
+	const size_t size = KDBUS_ITEM_HEADER_SIZE +
+			    sizeof(struct kdbus_memfd);
+	char tmp[size];
+	struct kdbus_item *it = (struct kdbus_item *)tmp;
+	int ret;
+
+	it->type = KDBUS_ITEM_PAYLOAD_MEMFD;
+	it->size = size;
+	it->memfd.size = item->vec.size;
+	it->memfd.fd = -1;
+	ret = kdbus_pool_write(conn->pool, off + items, it, size);
+	if (ret < 0)
+		return ret;
+
+	/* the fd number is updated at RECV time like for any other memfd */
+	queue->memfds[queue->memfds_count] =
+		items + offsetof(struct kdbus_item, memfd.fd);
+	queue->memfds_fp[queue->memfds_count] = fp;
+	queue->memfds_count++;
+
+	return 0;
 }
 
 static int kdbus_conn_payload_add(struct kdbus_conn *conn,
 				  struct kdbus_conn_queue *queue,
 				  const struct kdbus_kmsg *kmsg,
-				  size_t off, size_t items, size_t vec_data)
+				  size_t off, size_t items, size_t vec_data,
+				  struct file **vec_fps, unsigned int vec_memfds)
 {
 	const struct kdbus_item *item;
+	unsigned int memfds_count = kmsg->memfds_count + vec_memfds;
+	unsigned int memfd_index = 0;
+	unsigned int vec_index = 0;
 	int ret;
 
-	if (kmsg->memfds_count > 0) {
+	if (memfds_count > 0) {
 		size_t size;
 
-		size = kmsg->memfds_count * sizeof(size_t);
+		size = memfds_count * sizeof(size_t);
 		queue->memfds = kmalloc(size, GFP_KERNEL);
 		if (!queue->memfds)
 			return -ENOMEM;
 
-		size = kmsg->memfds_count * sizeof(struct file *);
+		size = memfds_count * sizeof(struct file *);
 		queue->memfds_fp = kzalloc(size, GFP_KERNEL);
 		if (!queue->memfds_fp)
 			return -ENOMEM;
@@ -209,6 +312,31 @@ static int kdbus_conn_payload_add(struct kdbus_conn *conn,
 			char tmp[size];
 			struct kdbus_item *it = (struct kdbus_item *)tmp;
 
+			if (kdbus_conn_vec_is_memfd(conn, item)) {
+				size_t pad = item->vec.size % 8;
+
+				ret = kdbus_conn_vec_memfd(conn, queue, item,
+							   vec_fps[vec_index],
+							   off, items);
+				if (ret < 0)
+					return ret;
+				vec_fps[vec_index++] = NULL;
+				items += KDBUS_ALIGN8(size);
+
+				/*
+				 * Preserve the alignment for the next payload
+				 * record, like for a \0-bytes record.
+				 */
+				if (pad > 0) {
+					kdbus_pool_write_user(conn->pool,
+							      off + vec_data,
+							      "\0\0\0\0\0\0\0",
+							      pad);
+					vec_data += pad;
+				}
+				break;
+			}
+
 			/* add item */
 			it->type = KDBUS_ITEM_PAYLOAD_OFF;
 			it->size = size;
@@ -258,9 +386,21 @@ static int kdbus_conn_payload_add(struct kdbus_conn *conn,
 					    sizeof(struct kdbus_memfd);
 			char tmp[size];
 			struct kdbus_item *it = (struct kdbus_item *)tmp;
-			struct file *fp;
+			struct file *fp = kmsg->memfds[memfd_index++];
 			size_t memfd;
 
+			/* small memfds are copied like a PAYLOAD_VEC */
+			if (item->memfd.size <= conn->memfd_inline_max) {
+				ret = kdbus_conn_memfd_inline(conn, item, fp, off,
+							      items, vec_data);
+				if (ret < 0)
+					return ret;
+
+				items += KDBUS_ALIGN8(size);
+				vec_data += item->memfd.size;
+				break;
+			}
+
 			/* add item */
 			it->type = KDBUS_ITEM_PAYLOAD_MEMFD;
 			it->size = size;
@@ -270,18 +410,14 @@ static int kdbus_conn_payload_add(struct kdbus_conn *conn,
 			if (ret < 0)
 				return ret;
 
-			/* grab reference of incoming file */
-			ret = kdbus_conn_memfd_ref(item, &fp);
-			if (ret < 0)
-				return ret;
-
 			/*
 			 * Remember the file and the location of the fd number
-			 * which will be updated at RECV time.
+			 * which will be updated at RECV time. All receivers
+			 * of a broadcast share the same sealed file.
 			 */
 			memfd = items + offsetof(struct kdbus_item, memfd.fd);
 			queue->memfds[queue->memfds_count] = memfd;
-			queue->memfds_fp[queue->memfds_count] = fp;
+			queue->memfds_fp[queue->memfds_count] = get_file(fp);
 			queue->memfds_count++;
 
 			items += KDBUS_ALIGN8((it)->size);
@@ -296,6 +432,181 @@ static int kdbus_conn_payload_add(struct kdbus_conn *conn,
 	return 0;
 }
 
+/* the pool is created on first use, until then all of it is free */
+static size_t kdbus_conn_pool_remain(struct kdbus_conn *conn)
+{
+	struct kdbus_pool *pool = ACCESS_ONCE(conn->pool);
+
+	return pool ? kdbus_pool_remain(pool) : conn->pool_size;
+}
+
+/**
+ * kdbus_conn_status_update() - publish the queue state in the status page
+ * @conn:		Connection
+ *
+ * Must be called with conn->lock held after the queue or the pool of the
+ * connection changed. The lock also makes sure there is only one writer
+ * of the sequence counter at a time.
+ */
+void kdbus_conn_status_update(struct kdbus_conn *conn)
+{
+	struct kdbus_conn_status *status = conn->status;
+
+	/* send-only connections have no status page */
+	if (!status)
+		return;
+
+	ACCESS_ONCE(status->seq) = status->seq + 1;
+	smp_wmb();
+
+	ACCESS_ONCE(status->msg_count) = conn->msg_count;
+	ACCESS_ONCE(status->msg_bytes) = conn->msg_bytes;
+	ACCESS_ONCE(status->pool_free) = kdbus_conn_pool_remain(conn);
+
+	smp_wmb();
+	ACCESS_ONCE(status->seq) = status->seq + 1;
+}
+
+/**
+ * kdbus_conn_pool_init() - make sure the pool of a connection exists
+ * @conn:		Connection
+ *
+ * The pool is created when it is mapped or something is stored in it
+ * for the first time, connections which never receive anything do not
+ * pay for a shmem file.
+ *
+ * No lock is taken: ->mmap() calls this with mmap_sem held, while
+ * senders fault in their pages with conn->lock held. Racing callers
+ * each create a pool, the one published first is kept.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_conn_pool_init(struct kdbus_conn *conn)
+{
+	struct kdbus_pool *pool;
+	int ret;
+
+	if (conn->flags & KDBUS_HELLO_SEND_ONLY)
+		return -EOPNOTSUPP;
+
+	if (likely(ACCESS_ONCE(conn->pool)))
+		return 0;
+
+	ret = kdbus_pool_new(&pool, conn->pool_size);
+	if (ret < 0)
+		return ret;
+
+	/* cmpxchg() orders the setup of the pool before its publication */
+	if (cmpxchg(&conn->pool, NULL, pool))
+		kdbus_pool_free(pool);
+
+	return 0;
+}
+
+/*
+ * Find the method call a message answers, if the caller reserved room
+ * for the reply. Called with conn->lock held.
+ */
+static struct kdbus_conn_reply *
+kdbus_conn_reply_find(struct kdbus_conn *conn, const struct kdbus_kmsg *kmsg)
+{
+	const struct kdbus_msg *msg = &kmsg->msg;
+	struct kdbus_conn_reply *reply;
+
+	if (likely(list_empty(&conn->reply_list)))
+		return NULL;
+
+	/* monitors see the replies to others */
+	if (msg->dst_id != conn->id)
+		return NULL;
+
+	/* the kernel answers for peers which did not reply in time or died */
+	if (msg->src_id == KDBUS_SRC_ID_KERNEL) {
+		if (kmsg->notification_type != KDBUS_ITEM_REPLY_TIMEOUT &&
+		    kmsg->notification_type != KDBUS_ITEM_REPLY_DEAD)
+			return NULL;
+	} else if (!(msg->flags & KDBUS_MSG_FLAGS_REPLY)) {
+		return NULL;
+	}
+
+	list_for_each_entry(reply, &conn->reply_list, entry)
+		if (reply->cookie == msg->cookie_reply &&
+		    (msg->src_id == KDBUS_SRC_ID_KERNEL ||
+		     msg->src_id == reply->dst_id))
+			return reply;
+
+	return NULL;
+}
+
+/*
+ * Keep room in the queue and the pool of a caller for the reply to a
+ * method call. This fails the way the delivery of the reply would, but
+ * before the call is made.
+ */
+static int kdbus_conn_reply_reserve(struct kdbus_conn *conn, u64 dst_id,
+				    u64 cookie, u64 deadline_ns)
+{
+	struct kdbus_conn_reply *reply;
+	size_t reserved;
+	int ret = 0;
+
+	reply = kzalloc(sizeof(struct kdbus_conn_reply), GFP_KERNEL);
+	if (!reply)
+		return -ENOMEM;
+
+	/*
+	 * The callee's queue expires the call at the same deadline, and
+	 * its REPLY_TIMEOUT, or a late reply, still needs the room.
+	 */
+	reply->dst_id = dst_id;
+	reply->cookie = cookie;
+	reply->deadline_ns = deadline_ns + KDBUS_CONN_REPLY_GRACE_NS;
+
+	mutex_lock(&conn->lock);
+	if (!capable(CAP_IPC_OWNER) &&
+	    conn->msg_count + conn->reply_count >= KDBUS_CONN_MAX_MSGS) {
+		ret = -ENOBUFS;
+		goto exit_unlock;
+	}
+
+	reserved = (conn->reply_count + 1) * KDBUS_CONN_REPLY_RESERVE_SIZE;
+	if (reserved > kdbus_conn_pool_remain(conn)) {
+		ret = -EXFULL;
+		goto exit_unlock;
+	}
+
+	list_add_tail(&reply->entry, &conn->reply_list);
+	conn->reply_count++;
+	reply = NULL;
+
+exit_unlock:
+	mutex_unlock(&conn->lock);
+	kfree(reply);
+	return ret;
+}
+
+/* give back the room reserved for a call which could not be delivered */
+static void kdbus_conn_reply_cancel(struct kdbus_conn *conn, u64 dst_id,
+				    u64 cookie)
+{
+	struct kdbus_conn_reply *reply;
+	bool found = false;
+
+	mutex_lock(&conn->lock);
+	list_for_each_entry_reverse(reply, &conn->reply_list, entry) {
+		if (reply->dst_id == dst_id && reply->cookie == cookie) {
+			list_del(&reply->entry);
+			conn->reply_count--;
+			found = true;
+			break;
+		}
+	}
+	mutex_unlock(&conn->lock);
+
+	if (found)
+		kfree(reply);
+}
+
 static void kdbus_conn_queue_cleanup(struct kdbus_conn_queue *queue)
 {
 	kdbus_conn_memfds_unref(queue);
@@ -307,6 +618,7 @@ static void kdbus_conn_queue_cleanup(struct kdbus_conn_queue *queue)
 static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *kmsg,
 			    u64 deadline_ns)
 {
+	struct kdbus_conn_reply *reply;
 	struct kdbus_conn_queue *queue;
 	u64 msg_size;
 	size_t size;
@@ -314,6 +626,10 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 	size_t fds = 0;
 	size_t meta = 0;
 	size_t vec_data;
+	size_t inline_size = 0;
+	size_t vec_memfd_size = 0;
+	unsigned int vec_memfds = 0;
+	struct file **vec_fps = NULL;
 	size_t want, have;
 	size_t off;
 	int ret = 0;
@@ -350,6 +666,37 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 			    kmsg->memfds_count;
 	}
 
+	/* space for the content of memfds to copy into the pool */
+	if (kmsg->memfds_count > 0 && conn->memfd_inline_max > 0) {
+		const struct kdbus_item *item;
+
+		KDBUS_ITEM_FOREACH(item, &kmsg->msg, items)
+			if (item->type == KDBUS_ITEM_PAYLOAD_MEMFD &&
+			    item->memfd.size <= conn->memfd_inline_max)
+				inline_size += item->memfd.size;
+	}
+
+	/* large vecs passed in a memfd only leave their padding in the pool */
+	if (kmsg->vecs_count > 0 && conn->vec_memfd_min > 0) {
+		const struct kdbus_item *item;
+
+		KDBUS_ITEM_FOREACH(item, &kmsg->msg, items)
+			if (item->type == KDBUS_ITEM_PAYLOAD_VEC &&
+			    kdbus_conn_vec_is_memfd(conn, item)) {
+				vec_memfd_size += round_down(item->vec.size, 8);
+				vec_memfds++;
+			}
+	}
+
+	if (vec_memfds > 0) {
+		ret = kdbus_conn_vec_memfds_new(conn, kmsg, vec_memfds,
+						&vec_fps);
+		if (ret < 0) {
+			kdbus_conn_queue_cleanup(queue);
+			return ret;
+		}
+	}
+
 	/* space for FDS item */
 	if (kmsg->fds_count > 0) {
 		fds = msg_size;
@@ -367,18 +714,52 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 
 	/* allocate the needed space in the pool of the receiver */
 	mutex_lock(&conn->lock);
-	if (!capable(CAP_IPC_OWNER) &&
-	    conn->msg_count > KDBUS_CONN_MAX_MSGS) {
+
+	/*
+	 * The liveness checks of the senders do not take the lock; the
+	 * queue is emptied with the lock held after the connection is
+	 * marked as disconnected, so check it again before linking into it.
+	 */
+	if (unlikely(atomic_read(&conn->disconnected))) {
+		ret = -ESRCH;
+		goto exit_unlock;
+	}
+
+	/* a reply the caller reserved room for is already counted */
+	reply = kdbus_conn_reply_find(conn, kmsg);
+
+	if (!reply && !capable(CAP_IPC_OWNER) &&
+	    conn->msg_count + conn->reply_count > KDBUS_CONN_MAX_MSGS) {
 		ret = -ENOBUFS;
 		goto exit_unlock;
 	}
 
-	/* do not give out more than half of the remaining space */
-	want = vec_data + kmsg->vecs_size;
-	have = kdbus_pool_remain(conn->pool);
-	if (want < have && want > have / 2) {
-		ret = -EXFULL;
+	ret = kdbus_conn_pool_init(conn);
+	if (ret < 0)
 		goto exit_unlock;
+
+	/*
+	 * Do not give out more than half of the remaining space, and
+	 * nothing of the space reserved for expected replies. A reply
+	 * which fits into its own reservation is always let in; a larger
+	 * one only gets its own share on top of the regular limits.
+	 */
+	want = vec_data + kmsg->vecs_size - vec_memfd_size + inline_size;
+	have = kdbus_pool_remain(conn->pool);
+	if (!reply || want > KDBUS_CONN_REPLY_RESERVE_SIZE) {
+		size_t reserved = (conn->reply_count - (reply ? 1 : 0)) *
+				  KDBUS_CONN_REPLY_RESERVE_SIZE;
+
+		if (reserved > 0 && want + reserved > have) {
+			ret = -EXFULL;
+			goto exit_unlock;
+		}
+
+		have -= reserved;
+		if (want < have && want > have / 2) {
+			ret = -EXFULL;
+			goto exit_unlock;
+		}
 	}
 
 	ret = kdbus_pool_alloc_range(conn->pool, want, &off);
@@ -388,19 +769,20 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 	/* copy the message header */
 	ret = kdbus_pool_write(conn->pool, off, &kmsg->msg, size);
 	if (ret < 0)
-		goto exit_unlock;
+		goto exit_free_range;
 
 	/* update the size */
 	ret = kdbus_pool_write(conn->pool, off, &msg_size, sizeof(kmsg->msg.size));
 	if (ret < 0)
-		goto exit_unlock;
+		goto exit_free_range;
 
 	/* add PAYLOAD items */
 	if (kmsg->vecs_count + kmsg->memfds_count > 0) {
-		ret = kdbus_conn_payload_add(conn, queue, kmsg,
-					     off, payloads, vec_data);
+		ret = kdbus_conn_payload_add(conn, queue, kmsg, off,
+					     payloads, vec_data,
+					     vec_fps, vec_memfds);
 		if (ret < 0)
-			goto exit_unlock;
+			goto exit_free_range;
 	}
 
 	/* add a FDS item; the array content will be updated at RECV time */
@@ -413,11 +795,11 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 		it->size = size + (kmsg->fds_count * sizeof(int));
 		ret = kdbus_pool_write(conn->pool, off + fds, it, size);
 		if (ret < 0)
-			goto exit_unlock;
+			goto exit_free_range;
 
 		ret = kdbus_conn_fds_ref(queue, kmsg->fds, kmsg->fds_count);
 		if (ret < 0)
-			goto exit_unlock;
+			goto exit_free_range;
 
 		/* remember the array to update at RECV */
 		queue->fds = fds + offsetof(struct kdbus_item, fds);
@@ -429,7 +811,22 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 		ret = kdbus_pool_write(conn->pool, off + meta,
 				       kmsg->meta.data, kmsg->meta.size);
 		if (ret < 0)
-			goto exit_unlock;
+			goto exit_free_range;
+	}
+
+	/*
+	 * The memfds of a broadcast are shared by all its receivers, none
+	 * of them may unseal it anymore once it is queued.
+	 */
+	if (kmsg->msg.dst_id == KDBUS_DST_ID_BROADCAST) {
+		unsigned int i;
+
+		for (i = 0; i < kmsg->memfds_count; i++) {
+			if (!kdbus_memfd_seal_pin(kmsg->memfds[i])) {
+				ret = -ETXTBSY;
+				goto exit_free_range;
+			}
+		}
 	}
 
 	/* remember the offset to the message */
@@ -439,21 +836,36 @@ static int kdbus_conn_queue_insert(struct kdbus_conn *conn, struct kdbus_kmsg *k
 	/* link the message into the receiver's queue */
 	list_add_tail(&queue->entry, &conn->msg_list);
 	conn->msg_count++;
+	conn->msg_bytes += queue->size;
+
+	/* the reply takes the place of its reservation */
+	if (reply) {
+		list_del(&reply->entry);
+		conn->reply_count--;
+	}
+
+	kdbus_conn_status_update(conn);
 	mutex_unlock(&conn->lock);
 
+	kfree(reply);
+	kdbus_conn_vec_memfds_free(vec_fps, vec_memfds);
+
 	/* wake up poll() */
 	wake_up_interruptible(&conn->ep->wait);
 	return 0;
 
+exit_free_range:
+	kdbus_pool_free_range(conn->pool, off);
 exit_unlock:
 	mutex_unlock(&conn->lock);
 	kdbus_conn_queue_cleanup(queue);
-	kdbus_pool_free_range(conn->pool, off);
+	kdbus_conn_vec_memfds_free(vec_fps, vec_memfds);
 	return ret;
 }
 
 static void kdbus_conn_scan_timeout(struct kdbus_conn *conn)
 {
+	struct kdbus_conn_reply *reply, *reply_tmp;
 	struct kdbus_conn_queue *queue, *tmp;
 	u64 deadline = -1;
 	struct timespec ts;
@@ -473,11 +885,25 @@ static void kdbus_conn_scan_timeout(struct kdbus_conn *conn)
 					queue->src_id, queue->cookie);
 			kdbus_pool_free_range(conn->pool, queue->off);
 			list_del(&queue->entry);
+			conn->msg_count--;
+			conn->msg_bytes -= queue->size;
 			kdbus_conn_queue_cleanup(queue);
 		} else if (queue->deadline_ns < deadline) {
 			deadline = queue->deadline_ns;
 		}
 	}
+
+	/* the call timed out a while ago, give back the room for its reply */
+	list_for_each_entry_safe(reply, reply_tmp, &conn->reply_list, entry) {
+		if (reply->deadline_ns <= now) {
+			list_del(&reply->entry);
+			conn->reply_count--;
+			kfree(reply);
+		} else if (reply->deadline_ns < deadline) {
+			deadline = reply->deadline_ns;
+		}
+	}
+	kdbus_conn_status_update(conn);
 	mutex_unlock(&conn->lock);
 
 	if (deadline != -1) {
@@ -511,7 +937,6 @@ static int kdbus_conn_get_conn_dst(struct kdbus_bus *bus,
 {
 	const struct kdbus_msg *msg = &kmsg->msg;
 	struct kdbus_conn *c;
-	bool disconnected;
 	int ret = 0;
 
 	if (msg->dst_id == KDBUS_DST_ID_NAME) {
@@ -533,28 +958,21 @@ static int kdbus_conn_get_conn_dst(struct kdbus_bus *bus,
 			goto exit_unref;
 		}
 	} else {
-		mutex_lock(&bus->lock);
 		c = kdbus_bus_find_conn_by_id(bus, msg->dst_id);
-		mutex_unlock(&bus->lock);
-
 		if (!c)
 			return -ENXIO;
 
 		/*
 		 * A starter connection is not allowed to be addressed
-		 * via its unique id.
+		 * via its unique id, a send-only connection not at all.
 		 */
-		if (c->flags & KDBUS_HELLO_STARTER) {
+		if (c->flags & (KDBUS_HELLO_STARTER | KDBUS_HELLO_SEND_ONLY)) {
 			ret = -ENXIO;
 			goto exit_unref;
 		}
 	}
 
-	mutex_lock(&c->lock);
-	disconnected = c->disconnected;
-	mutex_unlock(&c->lock);
-
-	if (disconnected) {
+	if (atomic_read(&c->disconnected)) {
 		ret = -ESRCH;
 		goto exit_unref;
 	}
@@ -571,74 +989,52 @@ exit_unref:
 	return ret;
 }
 
-/**
- * kdbus_conn_kmsg_send() - send a message
- * @ep:			Endpoint to send from
- * @conn_src:		Connection, kernel-generated messages do not have one
- * @kmsg:		Message to send
- *
- * Returns: 0 on success, negative errno on failure.
- */
-int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
-			 struct kdbus_conn *conn_src,
-			 struct kdbus_kmsg *kmsg)
+/* check if a connection receives broadcasts at all, called with the bus lock held */
+static bool kdbus_conn_broadcast_receiver(struct kdbus_conn *conn_dst)
 {
-	const struct kdbus_msg *msg = &kmsg->msg;
-	struct kdbus_conn *conn_dst = NULL;
-	struct kdbus_conn *conn;
-	u64 deadline_ns = 0;
-	int ret;
+	/* starter and send-only connections will not receive any broadcasts */
+	if (conn_dst->flags & (KDBUS_HELLO_STARTER | KDBUS_HELLO_SEND_ONLY))
+		return false;
 
-	/* broadcast message */
-	if (msg->dst_id == KDBUS_DST_ID_BROADCAST) {
-		unsigned int i;
+	return !atomic_read(&conn_dst->disconnected);
+}
 
-		mutex_lock(&ep->bus->lock);
-		hash_for_each(ep->bus->conn_hash, i, conn_dst, hentry) {
-			bool disconnected = false;
+/* queue a broadcast message for one receiver, called with the bus lock held */
+static void kdbus_conn_broadcast(struct kdbus_conn *conn_src,
+				 struct kdbus_conn *conn_dst,
+				 struct kdbus_kmsg *kmsg)
+{
+	if (conn_dst->id == kmsg->msg.src_id)
+		return;
 
-			if (conn_dst->id == msg->src_id)
-				continue;
+	if (!kdbus_match_db_match_kmsg(conn_dst->match_db, conn_src, kmsg))
+		return;
 
-			/*
-			 * starter connections will not receive any
-			 * broadcast messages.
-			 */
-			if (conn_dst->flags & KDBUS_HELLO_STARTER)
-				continue;
+	/*
+	 * The first receiver which requests additional metadata causes
+	 * the message to carry it; all receivers after that will see all
+	 * of the added data, even when they did not ask for it.
+	 */
+	kdbus_meta_append(&kmsg->meta, conn_src, conn_dst->attach_flags);
 
-			if (!kdbus_match_db_match_kmsg(conn_dst->match_db,
-						       conn_src, kmsg))
-				continue;
+	kdbus_conn_queue_insert(conn_dst, kmsg, 0);
+}
 
-			mutex_lock(&conn_dst->lock);
-			disconnected = conn_dst->disconnected;
-			mutex_unlock(&conn_dst->lock);
+/* deliver a direct message to a looked-up and connected receiver */
+static int __kdbus_conn_kmsg_send_conn(struct kdbus_ep *ep,
+				       struct kdbus_conn *conn_src,
+				       struct kdbus_conn *conn_dst,
+				       struct kdbus_kmsg *kmsg)
+{
+	const struct kdbus_msg *msg = &kmsg->msg;
+	bool reserve = msg->flags & KDBUS_MSG_FLAGS_RESERVE_REPLY;
+	struct kdbus_conn *conn;
+	u64 deadline_ns = 0;
+	int ret;
 
-			if (unlikely(disconnected))
-				continue;
-
-			/*
-			 * The first receiver which requests additional
-			 * metadata causes the message to carry it; all
-			 * receivers after that will see all of the added
-			 * data, even when they did not ask for it.
-			 */
-			kdbus_meta_append(&kmsg->meta, conn_src, conn_dst->attach_flags);
-
-			kdbus_conn_queue_insert(conn_dst, kmsg, 0);
-		}
-		mutex_unlock(&ep->bus->lock);
-
-		return 0;
-	}
-
-	/* direct message */
-	ret = kdbus_conn_get_conn_dst(ep->bus, kmsg, &conn_dst);
-	if (ret < 0)
-		return ret;
-
-	if (msg->timeout_ns) {
+	/* kernel messages and replies carry cookie_reply instead */
+	if (msg->timeout_ns && msg->src_id != KDBUS_SRC_ID_KERNEL &&
+	    !(msg->flags & KDBUS_MSG_FLAGS_REPLY)) {
 		struct timespec ts;
 
 		ktime_get_ts(&ts);
@@ -651,39 +1047,130 @@ int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 							conn_dst,
 							deadline_ns);
 		if (ret < 0)
-			goto exit;
+			return ret;
 	}
 
 	ret = kdbus_meta_append(&kmsg->meta, conn_src, conn_dst->attach_flags);
 	if (ret < 0)
-		goto exit;
+		return ret;
 
-	/* the monitor connections get all messages */
-	mutex_lock(&ep->bus->lock);
-	list_for_each_entry(conn, &ep->bus->monitors_list, monitor_entry) {
-		/* the monitor connection is addressed, deliver it below */
-		if (conn->id == conn_dst->id)
-			continue;
+	if (reserve) {
+		ret = kdbus_conn_reply_reserve(conn_src, conn_dst->id,
+					       msg->cookie, deadline_ns);
+		if (ret < 0)
+			return ret;
+	}
 
-		/* ignore errors of misbehaving monitor connections */
-		kdbus_conn_queue_insert(conn, kmsg, 0);
+	/*
+	 * The monitor connections get all messages. The unlocked check
+	 * spares the common case of a bus without monitors from taking
+	 * the lock; a monitor which is just being added might miss the
+	 * message, as if it had been added a moment later.
+	 */
+	if (!list_empty(&ep->bus->monitors_list)) {
+		down_read(&ep->bus->monitors_lock);
+		list_for_each_entry(conn, &ep->bus->monitors_list,
+				    monitor_entry) {
+			/* the monitor connection is addressed, deliver below */
+			if (conn->id == conn_dst->id)
+				continue;
+
+			/* ignore errors of misbehaving monitor connections */
+			kdbus_conn_queue_insert(conn, kmsg, 0);
+		}
+		up_read(&ep->bus->monitors_lock);
 	}
-	mutex_unlock(&ep->bus->lock);
 
 	ret = kdbus_conn_queue_insert(conn_dst, kmsg, deadline_ns);
-	if (ret < 0)
-		goto exit;
+	if (ret < 0) {
+		if (reserve)
+			kdbus_conn_reply_cancel(conn_src, conn_dst->id,
+						msg->cookie);
+		return ret;
+	}
 
-	if (msg->timeout_ns)
+	if (deadline_ns)
 		kdbus_conn_timeout_schedule_scan(conn_dst);
 
-exit:
+	/* the reservation expires with the call */
+	if (reserve)
+		kdbus_conn_timeout_schedule_scan(conn_src);
+
+	return 0;
+}
+
+/**
+ * kdbus_conn_kmsg_send() - send a message
+ * @ep:			Endpoint to send from
+ * @conn_src:		Connection, kernel-generated messages do not have one
+ * @kmsg:		Message to send
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
+			 struct kdbus_conn *conn_src,
+			 struct kdbus_kmsg *kmsg)
+{
+	const struct kdbus_msg *msg = &kmsg->msg;
+	struct kdbus_conn *conn_dst = NULL;
+	int ret;
+
+	/* broadcast message */
+	if (msg->dst_id == KDBUS_DST_ID_BROADCAST) {
+		struct radix_tree_iter iter;
+		void **slot;
+
+		mutex_lock(&ep->bus->conn_lock);
+		radix_tree_for_each_slot(slot, &ep->bus->conn_tree, &iter, 0) {
+			conn_dst = kdbus_bus_conn_slot(ep->bus, slot);
+			if (kdbus_conn_broadcast_receiver(conn_dst))
+				kdbus_conn_broadcast(conn_src, conn_dst, kmsg);
+		}
+		mutex_unlock(&ep->bus->conn_lock);
+
+		return 0;
+	}
+
+	/* direct message */
+	ret = kdbus_conn_get_conn_dst(ep->bus, kmsg, &conn_dst);
+	if (ret < 0)
+		return ret;
+
+	ret = __kdbus_conn_kmsg_send_conn(ep, conn_src, conn_dst, kmsg);
+
 	/* conn_dst got an extra ref from kdbus_conn_get_conn_dst */
 	kdbus_conn_unref(conn_dst);
 
 	return ret;
 }
 
+/**
+ * kdbus_conn_kmsg_send_conn() - send a message to a known connection
+ * @ep:			Endpoint to send from
+ * @conn_src:		Connection, kernel-generated messages do not have one
+ * @conn_dst:		The receiver, the caller holds a reference to it
+ * @kmsg:		Message to send
+ *
+ * Internal producers which already hold a reference to the receiver do
+ * not need to look it up again by the destination in the message.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_conn_kmsg_send_conn(struct kdbus_ep *ep,
+			      struct kdbus_conn *conn_src,
+			      struct kdbus_conn *conn_dst,
+			      struct kdbus_kmsg *kmsg)
+{
+	/* like by its unique id, a starter connection cannot be addressed */
+	if (conn_dst->flags & (KDBUS_HELLO_STARTER | KDBUS_HELLO_SEND_ONLY))
+		return -ENXIO;
+
+	if (atomic_read(&conn_dst->disconnected))
+		return -ESRCH;
+
+	return __kdbus_conn_kmsg_send_conn(ep, conn_src, conn_dst, kmsg);
+}
+
 /**
  * kdbus_conn_kmsg_free() - free a list of kmsg objects
  * @kmsg_list:		List head of kmsg objects to free.
@@ -705,6 +1192,11 @@ void kdbus_conn_kmsg_list_free(struct list_head *kmsg_list)
  * 			of kernel-generated messages
  * @kmsg_list:		List head of kmsg objects to send.
  *
+ * A list of broadcast messages, like the notifications about all the
+ * names of a connection which went away, is delivered in a single pass
+ * over the connections of the bus. Every receiver still gets the
+ * messages in the order of the list.
+ *
  * The list is cleared and freed after sending.
  * Returns 0 on success.
  */
@@ -712,137 +1204,181 @@ int kdbus_conn_kmsg_list_send(struct kdbus_ep *ep,
 			      struct kdbus_conn *conn_src,
 			      struct list_head *kmsg_list)
 {
+	struct kdbus_conn *conn_dst;
 	struct kdbus_kmsg *kmsg;
+	bool broadcast = true;
+	struct radix_tree_iter iter;
+	void **slot;
 	int ret = 0;
 
-	list_for_each_entry(kmsg, kmsg_list, queue_entry) {
-		ret = kdbus_conn_kmsg_send(ep, conn_src, kmsg);
-		if (ret < 0)
-			break;
+	list_for_each_entry(kmsg, kmsg_list, queue_entry)
+		if (kmsg->msg.dst_id != KDBUS_DST_ID_BROADCAST)
+			broadcast = false;
+
+	if (!broadcast) {
+		list_for_each_entry(kmsg, kmsg_list, queue_entry) {
+			ret = kdbus_conn_kmsg_send(ep, conn_src, kmsg);
+			if (ret < 0)
+				break;
+		}
+		goto exit_free;
 	}
 
+	if (list_empty(kmsg_list))
+		return 0;
+
+	mutex_lock(&ep->bus->conn_lock);
+	radix_tree_for_each_slot(slot, &ep->bus->conn_tree, &iter, 0) {
+		conn_dst = kdbus_bus_conn_slot(ep->bus, slot);
+		if (!kdbus_conn_broadcast_receiver(conn_dst))
+			continue;
+
+		list_for_each_entry(kmsg, kmsg_list, queue_entry)
+			kdbus_conn_broadcast(conn_src, conn_dst, kmsg);
+	}
+	mutex_unlock(&ep->bus->conn_lock);
+
+exit_free:
 	kdbus_conn_kmsg_list_free(kmsg_list);
 
 	return ret;
 }
 
-static int kdbus_conn_fds_install(struct kdbus_conn *conn,
-				  struct kdbus_conn_queue *queue)
+/*
+ * Install all passed files of a message in the receiver's process, called
+ * with conn->lock held.
+ *
+ * The fd numbers for the KDBUS_MSG_FDS and the PAYLOAD_MEMFD items are
+ * reserved in a single pass. Nothing is visible to the process before the
+ * final fd_install() calls, so a failure at any point only has to give the
+ * reserved numbers back.
+ */
+static int kdbus_conn_queue_install(struct kdbus_conn *conn,
+				    struct kdbus_conn_queue *queue)
 {
-	size_t size;
-	unsigned int i;
+	unsigned int count = queue->fds_count + queue->memfds_count;
+	unsigned int i, n;
 	int *fds;
 	int ret;
 
-	/* get array of file descriptors */
-	size = queue->fds_count * sizeof(int);
-	fds = kmalloc(size, GFP_KERNEL);
+	if (count == 0)
+		return 0;
+
+	/* do not reserve numbers at all if they cannot all be had */
+	if (count > rlimit(RLIMIT_NOFILE))
+		return -EMFILE;
+
+	fds = kmalloc(count * sizeof(int), GFP_KERNEL);
 	if (!fds)
 		return -ENOMEM;
 
-	/* allocate new file descriptors in the receiver's process */
-	for (i = 0; i < queue->fds_count; i++) {
-		fds[i] = get_unused_fd();
-		if (fds[i] < 0) {
-			ret = fds[i];
-			goto remove_unused;
-		}
+	/* the numbers of the FDS array come first, then the memfds */
+	for (n = 0; n < count; n++) {
+		ret = get_unused_fd();
+		if (ret < 0)
+			goto exit_put_unused;
+
+		fds[n] = ret;
 	}
 
 	/* copy the array into the message item */
-	ret = kdbus_pool_write(conn->pool, queue->off + queue->fds, fds, size);
-	if (ret < 0)
-		goto remove_unused;
+	if (queue->fds_count > 0) {
+		ret = kdbus_pool_write(conn->pool, queue->off + queue->fds,
+				       fds, queue->fds_count * sizeof(int));
+		if (ret < 0)
+			goto exit_put_unused;
+	}
+
+	/*
+	 * Update the file descriptor number in the items. We remembered
+	 * the locations of the values in the buffer.
+	 */
+	for (i = 0; i < queue->memfds_count; i++) {
+		ret = kdbus_pool_write(conn->pool,
+				       queue->off + queue->memfds[i],
+				       &fds[queue->fds_count + i], sizeof(int));
+		if (ret < 0)
+			goto exit_put_unused;
+	}
 
 	/* install files in the receiver's process */
 	for (i = 0; i < queue->fds_count; i++)
 		fd_install(fds[i], get_file(queue->fds_fp[i]));
 
+	for (i = 0; i < queue->memfds_count; i++)
+		fd_install(fds[queue->fds_count + i],
+			   get_file(queue->memfds_fp[i]));
+
 	kfree(fds);
 	return 0;
 
-remove_unused:
-	for (i = 0; i < queue->fds_count; i++) {
-		if (fds[i] < 0)
-			break;
-
+exit_put_unused:
+	for (i = 0; i < n; i++)
 		put_unused_fd(fds[i]);
-	}
 
 	kfree(fds);
 	return ret;
 }
 
-static int kdbus_conn_memfds_install(struct kdbus_conn *conn,
-				     struct kdbus_conn_queue *queue,
-				     int **memfds)
+/*
+ * Invalidate the KDBUS_MSG_FDS array of a message whose files are
+ * installed later; PAYLOAD_MEMFD items already carry -1 from the sender.
+ */
+static int kdbus_conn_fds_defer(struct kdbus_conn *conn,
+				struct kdbus_conn_queue *queue)
 {
 	size_t size;
 	int *fds;
-	unsigned int i;
-	int ret = 0;
+	int ret;
 
-	size = queue->memfds_count * sizeof(int);
+	size = queue->fds_count * sizeof(int);
 	fds = kmalloc(size, GFP_KERNEL);
 	if (!fds)
 		return -ENOMEM;
 
-	/* allocate new file descriptors in the receiver's process */
-	for (i = 0; i < queue->memfds_count; i++) {
-		fds[i] = get_unused_fd();
-		if (fds[i] < 0) {
-			ret = fds[i];
-			goto remove_unused;
-		}
-	}
-
-	/*
-	 * Update the file descriptor number in the items. We remembered
-	 * the locations of the values in the buffer.
-	 */
-	for (i = 0; i < queue->memfds_count; i++) {
-		ret = kdbus_pool_write(conn->pool,
-				       queue->off + queue->memfds[i],
-				       &fds[i], sizeof(int));
-		if (ret < 0)
-			goto remove_unused;
-	}
-
-	/* install files in the receiver's process */
-	for (i = 0; i < queue->memfds_count; i++)
-		fd_install(fds[i], get_file(queue->memfds_fp[i]));
+	memset(fds, 0xff, size);
+	ret = kdbus_pool_write(conn->pool, queue->off + queue->fds, fds, size);
+	kfree(fds);
 
-	*memfds = fds;
-	return 0;
+	return ret < 0 ? ret : 0;
+}
 
-remove_unused:
-	for (i = 0; i < queue->memfds_count; i++) {
-		if (fds[i] < 0)
-			break;
+/* find a received message with deferred files, called with conn->lock held */
+static struct kdbus_conn_queue *
+kdbus_conn_lazy_find(struct kdbus_conn *conn, u64 off)
+{
+	struct kdbus_conn_queue *queue;
 
-		put_unused_fd(fds[i]);
-	}
+	list_for_each_entry(queue, &conn->lazy_list, entry)
+		if (queue->off == off)
+			return queue;
 
-	kfree(fds);
-	*memfds = NULL;
-	return ret;
+	return NULL;
 }
 
 /**
  * kdbus_conn_recv_msg - receive a message from the queue
  * @conn:		Connection to receive from
- * @buf:		The returned offset to the message in the pool
+ * @flags:		KDBUS_RECV_* flags
+ * @off:		The returned offset to the message in the pool
+ *
+ * With KDBUS_RECV_LAZY_FDS, the passed files of the message stay
+ * referenced by the queue entry, which is kept on the lazy list until
+ * they are installed with kdbus_conn_install_fds() or the message is
+ * freed.
  *
  * Returns: 0 on success, negative errno on failure.
  */
-int kdbus_conn_recv_msg(struct kdbus_conn *conn, __u64 __user *buf)
+int kdbus_conn_recv_msg(struct kdbus_conn *conn, u64 flags, u64 *off)
 {
 	struct kdbus_conn_queue *queue;
-	u64 off;
-	int *memfds = NULL;
-	unsigned int i;
+	size_t msg_off, msg_size;
+	bool lazy;
 	int ret;
 
+	if (conn->flags & KDBUS_HELLO_SEND_ONLY)
+		return -EOPNOTSUPP;
+
 	mutex_lock(&conn->lock);
 	if (conn->msg_count == 0) {
 		ret = -EAGAIN;
@@ -852,32 +1388,70 @@ int kdbus_conn_recv_msg(struct kdbus_conn *conn, __u64 __user *buf)
 	/* return the address of the next message in the pool */
 	queue = list_first_entry(&conn->msg_list,
 				 struct kdbus_conn_queue, entry);
-	off = queue->off;
-	if (copy_to_user(buf, &off, sizeof(__u64))) {
-		ret = -EFAULT;
-		goto exit_unlock;
-	}
 
-	/*
-	 * Install KDBUS_MSG_PAYLOAD_MEMFDs file descriptors, we return
-	 * the list of file descriptors to be able to cleanup on error.
-	 */
-	if (queue->memfds_count > 0) {
-		ret = kdbus_conn_memfds_install(conn, queue, &memfds);
+	lazy = (flags & KDBUS_RECV_LAZY_FDS) &&
+	       queue->fds_count + queue->memfds_count > 0;
+
+	if (lazy) {
+		if (queue->fds_count > 0) {
+			ret = kdbus_conn_fds_defer(conn, queue);
+			if (ret < 0)
+				goto exit_unlock;
+		}
+	} else {
+		ret = kdbus_conn_queue_install(conn, queue);
 		if (ret < 0)
 			goto exit_unlock;
 	}
 
-	/* install KDBUS_MSG_FDS file descriptors */
-	if (queue->fds_count > 0) {
-		ret = kdbus_conn_fds_install(conn, queue);
-		if (ret < 0)
-			goto exit_rewind;
+	msg_off = queue->off;
+	msg_size = queue->size;
+
+	*off = msg_off;
+	conn->msg_count--;
+	conn->msg_bytes -= queue->size;
+	kdbus_conn_status_update(conn);
+	list_del(&queue->entry);
+	if (lazy)
+		list_add_tail(&queue->entry, &conn->lazy_list);
+	mutex_unlock(&conn->lock);
+
+	kdbus_pool_flush_dcache(conn->pool, msg_off, msg_size);
+	if (!lazy)
+		kdbus_conn_queue_cleanup(queue);
+	return 0;
+
+exit_unlock:
+	mutex_unlock(&conn->lock);
+	return ret;
+}
+
+/**
+ * kdbus_conn_install_fds() - install the deferred files of a message
+ * @conn:		Connection which received the message
+ * @off:		Offset of the message in the pool
+ *
+ * If the installation fails, the files stay deferred and the call can
+ * be retried.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_conn_install_fds(struct kdbus_conn *conn, u64 off)
+{
+	struct kdbus_conn_queue *queue;
+	int ret;
+
+	mutex_lock(&conn->lock);
+	queue = kdbus_conn_lazy_find(conn, off);
+	if (!queue) {
+		ret = -ENXIO;
+		goto exit_unlock;
 	}
 
-	kfree(memfds);
+	ret = kdbus_conn_queue_install(conn, queue);
+	if (ret < 0)
+		goto exit_unlock;
 
-	conn->msg_count--;
 	list_del(&queue->entry);
 	mutex_unlock(&conn->lock);
 
@@ -885,38 +1459,134 @@ int kdbus_conn_recv_msg(struct kdbus_conn *conn, __u64 __user *buf)
 	kdbus_conn_queue_cleanup(queue);
 	return 0;
 
-exit_rewind:
-	for (i = 0; i < queue->memfds_count; i++)
-		sys_close(memfds[i]);
-	kfree(memfds);
-
 exit_unlock:
 	mutex_unlock(&conn->lock);
 	return ret;
 }
 
+/**
+ * kdbus_conn_free_range() - release a received message
+ * @conn:		Connection owning the pool
+ * @off:		Offset of the allocation in the pool
+ *
+ * Besides giving the memory back to the pool, this drops the files of
+ * a message received with KDBUS_RECV_LAZY_FDS which were never
+ * installed.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_conn_free_range(struct kdbus_conn *conn, u64 off)
+{
+	struct kdbus_conn_queue *queue = NULL;
+	int ret;
+
+	if (conn->flags & KDBUS_HELLO_SEND_ONLY)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&conn->lock);
+	/* nothing was ever handed out of a pool which does not exist */
+	if (conn->pool)
+		ret = kdbus_pool_free_range(conn->pool, off);
+	else
+		ret = -ENXIO;
+	if (ret == 0) {
+		queue = kdbus_conn_lazy_find(conn, off);
+		if (queue)
+			list_del(&queue->entry);
+
+		kdbus_conn_status_update(conn);
+	}
+	mutex_unlock(&conn->lock);
+
+	if (queue)
+		kdbus_conn_queue_cleanup(queue);
+
+	return ret;
+}
+
+/**
+ * kdbus_conn_busy_poll() - spin until a message is queued
+ * @conn:		Connection to receive from
+ * @usecs:		Maximum time to spin, in microseconds
+ *
+ * Latency-critical receivers avoid the sleep and wakeup of poll() by
+ * spinning for a short time. The spin is cut short as soon as the CPU
+ * is needed by someone else or a signal is pending.
+ *
+ * Returns: true if a message is queued
+ */
+bool kdbus_conn_busy_poll(struct kdbus_conn *conn, u64 usecs)
+{
+	u64 deadline = local_clock() + usecs * NSEC_PER_USEC;
+
+	while (ACCESS_ONCE(conn->msg_count) == 0) {
+		if (atomic_read(&conn->disconnected))
+			return false;
+
+		if (need_resched() || signal_pending(current))
+			return false;
+
+		if (local_clock() >= deadline)
+			return false;
+
+		cpu_relax();
+	}
+
+	return true;
+}
+
+/**
+ * kdbus_conn_status_mmap() - map the status page into the process
+ * @conn:		Connection
+ * @vma:		passed by mmap() syscall
+ *
+ * Returns: the result of the mmap() call, negative errno on failure.
+ */
+int kdbus_conn_status_mmap(struct kdbus_conn *conn, struct vm_area_struct *vma)
+{
+	/* the status is only written by the kernel */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	if ((vma->vm_end - vma->vm_start) > PAGE_SIZE)
+		return -EFAULT;
+
+	return remap_vmalloc_range(vma, conn->status, 0);
+}
+
 void kdbus_conn_disconnect(struct kdbus_conn *conn)
 {
+	struct kdbus_conn_reply *reply, *reply_tmp;
 	struct kdbus_conn_queue *queue, *tmp;
 	struct list_head list;
 	struct kdbus_bus *bus;
+	bool bus_dead;
 
-	mutex_lock(&conn->lock);
-	if (conn->disconnected) {
-		mutex_unlock(&conn->lock);
+	if (atomic_xchg(&conn->disconnected, 1))
 		return;
-	}
 
-	conn->disconnected = true;
-	mutex_unlock(&conn->lock);
+	/* count in the shared atomic from now on, see kdbus_bus_disconnect() */
+	percpu_ref_get(&conn->ref);
+	percpu_ref_kill(&conn->ref);
 
 	bus = conn->ep->bus;
 
+	/*
+	 * When the whole bus goes away, all peers are torn down as well;
+	 * telling them about this connection would only cost a walk over
+	 * all of them for every single connection.
+	 */
+	bus_dead = atomic_read(&bus->disconnected);
+
 	/* remove from bus */
-	mutex_lock(&bus->lock);
-	hash_del(&conn->hentry);
-	list_del(&conn->monitor_entry);
-	mutex_unlock(&bus->lock);
+	mutex_lock(&bus->conn_lock);
+	radix_tree_delete(&bus->conn_tree, conn->id);
+	mutex_unlock(&bus->conn_lock);
+
+	down_write(&bus->monitors_lock);
+	list_del_init(&conn->monitor_entry);
+	up_write(&bus->monitors_lock);
 
 	/* clean up any messages still left on this endpoint */
 	INIT_LIST_HEAD(&list);
@@ -929,13 +1599,31 @@ void kdbus_conn_disconnect(struct kdbus_conn *conn)
 		 * kdbus_notify_reply_dead(); move these messages
 		 * into a temporary list and handle them below.
 		 */
-		if (queue->src_id != conn->id && queue->expect_reply) {
+		if (!bus_dead &&
+		    queue->src_id != conn->id && queue->expect_reply) {
 			list_add_tail(&queue->entry, &list);
 		} else {
 			kdbus_pool_free_range(conn->pool, queue->off);
 			kdbus_conn_queue_cleanup(queue);
 		}
 	}
+	conn->msg_count = 0;
+	conn->msg_bytes = 0;
+
+	/* drop the files of received messages which were never installed */
+	list_for_each_entry_safe(queue, tmp, &conn->lazy_list, entry) {
+		list_del(&queue->entry);
+		kdbus_conn_queue_cleanup(queue);
+	}
+
+	/* no reply will be waited for anymore */
+	list_for_each_entry_safe(reply, reply_tmp, &conn->reply_list, entry) {
+		list_del(&reply->entry);
+		kfree(reply);
+	}
+	conn->reply_count = 0;
+
+	kdbus_conn_status_update(conn);
 	mutex_unlock(&conn->lock);
 
 	list_for_each_entry_safe(queue, tmp, &list, entry) {
@@ -943,30 +1631,59 @@ void kdbus_conn_disconnect(struct kdbus_conn *conn)
 					queue->cookie);
 		mutex_lock(&conn->lock);
 		kdbus_pool_free_range(conn->pool, queue->off);
+		kdbus_conn_status_update(conn);
 		mutex_unlock(&conn->lock);
 		kdbus_conn_queue_cleanup(queue);
 	}
 
-	kdbus_notify_id_change(conn->ep, KDBUS_ITEM_ID_REMOVE,
-			       conn->id, conn->flags);
+	if (!bus_dead)
+		kdbus_notify_id_change(conn->ep, KDBUS_ITEM_ID_REMOVE,
+				       conn->id, conn->flags);
 
 	del_timer(&conn->timer);
 	cancel_work_sync(&conn->work);
 	kdbus_name_remove_by_conn(bus->name_registry, conn);
 }
 
-static void __kdbus_conn_free(struct kref *kref)
+static void __kdbus_conn_free(struct kdbus_conn *conn)
 {
-	struct kdbus_conn *conn = container_of(kref, struct kdbus_conn, kref);
+	/* a connection which failed to set up was never disconnected */
+	del_timer_sync(&conn->timer);
+	cancel_work_sync(&conn->work);
 
-	kdbus_conn_disconnect(conn);
 	if (conn->ep->policy_db)
 		kdbus_policy_db_remove_conn(conn->ep->policy_db, conn);
-	kdbus_match_db_free(conn->match_db);
-	kdbus_meta_free(&conn->meta);
+	if (conn->match_db)
+		kdbus_match_db_free(conn->match_db);
+	if (conn->meta) {
+		kdbus_meta_free(conn->meta);
+		kfree(conn->meta);
+	}
+	kdbus_ring_free(conn->ring);
+	kdbus_memfd_cache_free(conn->memfd_cache);
 	kdbus_pool_free(conn->pool);
+	vfree(conn->status);
+	put_pid(conn->pid);
 	kdbus_ep_unref(conn->ep);
-	kfree(conn);
+
+	/* lookups by ID may still look at the connection */
+	kfree_rcu(conn, rcu);
+}
+
+static void kdbus_conn_free_work(struct work_struct *work)
+{
+	struct kdbus_conn *conn =
+		container_of(work, struct kdbus_conn, free_work);
+
+	__kdbus_conn_free(conn);
+}
+
+/* the last put may happen in RCU callback context, free from a worker */
+static void kdbus_conn_release(struct percpu_ref *ref)
+{
+	struct kdbus_conn *conn = container_of(ref, struct kdbus_conn, ref);
+
+	schedule_work(&conn->free_work);
 }
 
 /**
@@ -977,7 +1694,7 @@ static void __kdbus_conn_free(struct kref *kref)
  */
 struct kdbus_conn *kdbus_conn_ref(struct kdbus_conn *conn)
 {
-	kref_get(&conn->kref);
+	percpu_ref_get(&conn->ref);
 	return conn;
 }
 
@@ -986,7 +1703,8 @@ struct kdbus_conn *kdbus_conn_ref(struct kdbus_conn *conn)
  * @conn:		Connection (may be NULL)
  *
  * When the last reference is dropped, the connection's internal structure
- * is freed.
+ * is freed. Until the connection is disconnected, the references are
+ * counted per CPU and this never happens.
  *
  * Returns: NULL
  */
@@ -995,7 +1713,7 @@ struct kdbus_conn *kdbus_conn_unref(struct kdbus_conn *conn)
 	if (!conn)
 		return NULL;
 
-	kref_put(&conn->kref, __kdbus_conn_free);
+	percpu_ref_put(&conn->ref);
 	return NULL;
 }
 
@@ -1026,9 +1744,17 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 	mutex_lock(&conn_src->lock);
 	list_splice_init(&conn_src->msg_list, &msg_list);
 	conn_src->msg_count = 0;
+	conn_src->msg_bytes = 0;
+	kdbus_conn_status_update(conn_src);
 	mutex_unlock(&conn_src->lock);
 
 	mutex_lock(&conn_dst->lock);
+	if (!list_empty(&msg_list)) {
+		ret = kdbus_conn_pool_init(conn_dst);
+		if (ret < 0)
+			goto exit_unlock_dst;
+	}
+
 	list_for_each_entry_safe(queue, tmp, &msg_list, entry) {
 		ret = kdbus_pool_move(conn_dst->pool, conn_src->pool,
 				      &queue->off, queue->size);
@@ -1037,16 +1763,76 @@ int kdbus_conn_move_messages(struct kdbus_conn *conn_dst,
 
 		list_add_tail(&queue->entry, &conn_dst->msg_list);
 		conn_dst->msg_count++;
+		conn_dst->msg_bytes += queue->size;
 	}
 
 exit_unlock_dst:
+	kdbus_conn_status_update(conn_dst);
 	mutex_unlock(&conn_dst->lock);
 
+	/* the moved messages gave back space in the source pool */
+	mutex_lock(&conn_src->lock);
+	kdbus_conn_status_update(conn_src);
+	mutex_unlock(&conn_src->lock);
+
 	wake_up_interruptible(&conn_dst->ep->wait);
 
 	return ret;
 }
 
+/*
+ * Walking the creator's memory for the executable, the command line and
+ * the cgroup path is expensive; it is deferred from HELLO to the first
+ * query. If the creator is gone by then, the items are left out.
+ */
+#define KDBUS_CONN_META_LAZY	(KDBUS_ATTACH_EXE | \
+				 KDBUS_ATTACH_CMDLINE | \
+				 KDBUS_ATTACH_CGROUP)
+
+static int kdbus_conn_meta_complete(struct kdbus_conn *conn)
+{
+	struct kdbus_meta lazy = {};
+	struct task_struct *task;
+	bool complete;
+	int ret = 0;
+
+	mutex_lock(&conn->lock);
+	complete = (conn->meta->attached & KDBUS_CONN_META_LAZY) ==
+		   KDBUS_CONN_META_LAZY;
+	mutex_unlock(&conn->lock);
+
+	if (complete)
+		return 0;
+
+	/* every send path takes the lock, do not walk the memory under it */
+	task = get_pid_task(conn->pid, PIDTYPE_PID);
+	if (task) {
+		ret = kdbus_meta_append_task(&lazy, task,
+					     KDBUS_CONN_META_LAZY);
+		put_task_struct(task);
+		if (ret < 0)
+			goto exit_free;
+	}
+
+	/*
+	 * A failed attempt adds nothing and is retried by the next query;
+	 * of two concurrent ones, only the first result is published. The
+	 * metadata does not change after this, readers do not take the lock.
+	 */
+	mutex_lock(&conn->lock);
+	if ((conn->meta->attached & KDBUS_CONN_META_LAZY) !=
+	    KDBUS_CONN_META_LAZY) {
+		ret = kdbus_meta_merge(conn->meta, &lazy);
+		if (ret == 0)
+			conn->meta->attached |= KDBUS_CONN_META_LAZY;
+	}
+	mutex_unlock(&conn->lock);
+
+exit_free:
+	kdbus_meta_free(&lazy);
+	return ret;
+}
+
 /**
  * kdbus_cmd_conn_info() - retrieve info about a connection
  * @conn:		Connection
@@ -1084,9 +1870,7 @@ int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 	if (cmd_info->id != 0) {
 		struct kdbus_bus *bus = conn->ep->bus;
 
-		mutex_lock(&bus->lock);
 		owner_conn = kdbus_bus_find_conn_by_id(bus, cmd_info->id);
-		mutex_unlock(&bus->lock);
 	} else {
 		if (size == sizeof(struct kdbus_cmd_conn_info)) {
 			ret = -EINVAL;
@@ -1125,8 +1909,12 @@ int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 		goto exit_free;
 	}
 
+	ret = kdbus_conn_meta_complete(owner_conn);
+	if (ret < 0)
+		goto exit_unref_owner_conn;
+
 	info.size = sizeof(struct kdbus_conn_info) +
-		    owner_conn->meta.size;
+		    owner_conn->meta->size;
 	info.id = owner_conn->id;
 	info.flags = owner_conn->flags;
 
@@ -1145,6 +1933,10 @@ int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 		info.size += meta.size;
 	}
 
+	ret = kdbus_conn_pool_init(conn);
+	if (ret < 0)
+		goto exit_unref_owner_conn;
+
 	ret = kdbus_pool_alloc_range(conn->pool, info.size, &off);
 	if (ret < 0)
 		goto exit_unref_owner_conn;
@@ -1154,11 +1946,11 @@ int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 		goto exit_free;
 	pos = off + sizeof(struct kdbus_conn_info);
 
-	ret = kdbus_pool_write(conn->pool, pos, owner_conn->meta.data,
-			       owner_conn->meta.size);
+	ret = kdbus_pool_write(conn->pool, pos, owner_conn->meta->data,
+			       owner_conn->meta->size);
 	if (ret < 0)
 		goto exit_free;
-	pos += owner_conn->meta.size;
+	pos += owner_conn->meta->size;
 
 	if (meta.size > 0) {
 		ret = kdbus_pool_write(conn->pool, pos, meta.data, meta.size);
@@ -1173,6 +1965,10 @@ int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 		goto exit_free;
 	}
 
+	mutex_lock(&conn->lock);
+	kdbus_conn_status_update(conn);
+	mutex_unlock(&conn->lock);
+
 exit_free:
 	if (ret < 0)
 		kdbus_pool_free_range(conn->pool, off);
@@ -1222,38 +2018,99 @@ int kdbus_conn_new(struct kdbus_ep *ep,
 	if ((hello->conn_flags & KDBUS_HELLO_STARTER) && !starter_name)
 		return -EINVAL;
 
+	/* a starter receives the messages for its name */
+	if ((hello->conn_flags & KDBUS_HELLO_STARTER) &&
+	    (hello->conn_flags & KDBUS_HELLO_SEND_ONLY))
+		return -EINVAL;
+
+	if (hello->memfd_inline_max > KDBUS_CONN_MAX_MEMFD_INLINE)
+		return -EINVAL;
+
+	if (hello->vec_memfd_min > 0 &&
+	    hello->vec_memfd_min < KDBUS_CONN_MIN_VEC_MEMFD)
+		return -EINVAL;
+
 	conn = kzalloc(sizeof(*conn), GFP_KERNEL);
 	if (!conn)
 		return -ENOMEM;
 
-	kref_init(&conn->kref);
+	ret = percpu_ref_init(&conn->ref, kdbus_conn_release);
+	if (ret < 0) {
+		kfree(conn);
+		return ret;
+	}
+
+	INIT_WORK(&conn->free_work, kdbus_conn_free_work);
+	conn->ep = kdbus_ep_ref(ep);
+	conn->flags = hello->conn_flags;
+	conn->attach_flags = hello->attach_flags;
 	mutex_init(&conn->lock);
+	conn->memfd_inline_max = hello->memfd_inline_max;
+	conn->vec_memfd_min = hello->vec_memfd_min;
+	conn->pool_size = hello->pool_size;
+	conn->pid = get_task_pid(current, PIDTYPE_PID);
 	INIT_LIST_HEAD(&conn->msg_list);
+	INIT_LIST_HEAD(&conn->reply_list);
+	INIT_LIST_HEAD(&conn->lazy_list);
 	INIT_LIST_HEAD(&conn->names_list);
 	INIT_LIST_HEAD(&conn->names_queue_list);
 	INIT_LIST_HEAD(&conn->monitor_entry);
 	INIT_WORK(&conn->work, kdbus_conn_work);
 	init_timer(&conn->timer);
-	conn->timer.expires = 0;
 	conn->timer.function = kdbus_conn_timer_func;
 	conn->timer.data = (unsigned long) conn;
-	add_timer(&conn->timer);
 
-	ret = kdbus_pool_new(&conn->pool, hello->pool_size);
-	if (ret < 0)
-		goto exit_unref;
+	/*
+	 * A send-only connection never has anything queued; it needs no
+	 * status page or match database. The pool of the others is created
+	 * on first use, and the timeout timer is armed by the first message
+	 * which carries a timeout.
+	 */
+	if (!(conn->flags & KDBUS_HELLO_SEND_ONLY)) {
+		conn->status = vmalloc_user(PAGE_SIZE);
+		if (!conn->status) {
+			ret = -ENOMEM;
+			goto exit_free;
+		}
 
-	ret = kdbus_match_db_new(&conn->match_db);
-	if (ret < 0)
-		goto exit_unref;
+		kdbus_conn_status_update(conn);
 
-	conn->ep = kdbus_ep_ref(ep);
+		ret = kdbus_match_db_new(&conn->match_db);
+		if (ret < 0)
+			goto exit_free;
+	}
+
+	conn->memfd_cache = kdbus_memfd_cache_new();
+	if (!conn->memfd_cache) {
+		ret = -ENOMEM;
+		goto exit_free;
+	}
+
+	/* kept out of line, it is only needed for KDBUS_CMD_CONN_INFO */
+	conn->meta = kzalloc(sizeof(*conn->meta), GFP_KERNEL);
+	if (!conn->meta) {
+		ret = -ENOMEM;
+		goto exit_free;
+	}
 
 	/* link into bus; get new id for this connection */
-	mutex_lock(&bus->lock);
-	conn->id = bus->conn_id_next++;
-	hash_add(bus->conn_hash, &conn->hentry, conn->id);
-	mutex_unlock(&bus->lock);
+	conn->id = atomic64_inc_return(&bus->conn_id_next);
+
+	/* the tree is indexed by unsigned long; on 32-bit, larger IDs wrap */
+	if (conn->id > ULONG_MAX) {
+		ret = -ENOSPC;
+		goto exit_free;
+	}
+
+	mutex_lock(&bus->conn_lock);
+	/* the teardown of the bus walks the tree under the same lock */
+	if (atomic_read(&bus->disconnected))
+		ret = -ESHUTDOWN;
+	else
+		ret = radix_tree_insert(&bus->conn_tree, conn->id, conn);
+	mutex_unlock(&bus->conn_lock);
+	if (ret < 0)
+		goto exit_free;
 
 	/* return properties of this connection to the caller */
 	hello->bus_flags = bus->bus_flags;
@@ -1263,12 +2120,9 @@ int kdbus_conn_new(struct kdbus_ep *ep,
 	BUILD_BUG_ON(sizeof(bus->id128) != sizeof(hello->id128));
 	memcpy(hello->id128, bus->id128, sizeof(hello->id128));
 
-	ret = kdbus_meta_append(&conn->meta, conn,
+	ret = kdbus_meta_append(conn->meta, conn,
 				KDBUS_ATTACH_CREDS |
 				KDBUS_ATTACH_COMM |
-				KDBUS_ATTACH_EXE |
-				KDBUS_ATTACH_CMDLINE |
-				KDBUS_ATTACH_CGROUP |
 				KDBUS_ATTACH_CAPS |
 				KDBUS_ATTACH_SECLABEL |
 				KDBUS_ATTACH_AUDIT);
@@ -1281,9 +2135,6 @@ int kdbus_conn_new(struct kdbus_ep *ep,
 	if (ret < 0)
 		goto exit_unref;
 
-	conn->flags = hello->conn_flags;
-	conn->attach_flags = hello->attach_flags;
-
 	if (starter_name) {
 		ret = kdbus_name_acquire(bus->name_registry, conn,
 					 starter_name, 0, NULL);
@@ -1295,6 +2146,13 @@ int kdbus_conn_new(struct kdbus_ep *ep,
 	return 0;
 
 exit_unref:
+	kdbus_conn_disconnect(conn);
 	kdbus_conn_unref(conn);
 	return ret;
+
+exit_free:
+	/* nobody else knows about the connection yet */
+	percpu_ref_cancel_init(&conn->ref);
+	__kdbus_conn_free(conn);
+	return ret;
 }
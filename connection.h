@@ -13,58 +13,92 @@
 #ifndef __KDBUS_CONNECTION_H
 #define __KDBUS_CONNECTION_H
 
+#include <linux/percpu-refcount.h>
+
 #include "internal.h"
 #include "pool.h"
-#include "metadata.h"
 
 /**
  * struct kdbus_conn - connection to a bus
- * @kref:		Reference count
- * @disconnected:	Invalidated data
+ * @ref:		Reference count, per-CPU until disconnected
+ * @disconnected:	Invalidated data, read without taking @lock
  * @ep:			The endpoint this connection belongs to
  * @id:			Connection ID
  * @flags:		KDBUS_HELLO_* flags
  * @attach_flags:	KDBUS_ATTACH_* flags
+ * @memfd_inline_max:	Maximum size of memfds to copy into the pool
+ * @vec_memfd_min:	Minimum size of vecs to pass in a memfd instead
+ * @pool:		The user's buffer to receive messages, created on first use
+ * @pool_size:		Size of @pool as requested at HELLO
+ * @match_db:		Subscription filter to broadcast messages
+ * @status:		Status page shared read-only with userspace
+ * @meta:		Cached connection creator's metadata/credentials
+ * @pid:		Creator, to collect the rest of @meta from when queried
  * @lock:		Connection data lock
  * @msg_list:		Queue of messages
- * @hentry:		Entry in ID <-> connection map
+ * @msg_count:		Number of queued messages
+ * @msg_bytes:		Pool space used by queued messages
+ * @reply_list:		Method calls which reserved room for their reply
+ * @reply_count:	Number of entries in @reply_list
+ * @lazy_list:		Received messages with files not yet installed
+ * @ring:		Optional submission/completion rings
+ * @memfd_cache:	Closed memfds of this connection kept for reuse
  * @monitor_entry:	The connection is a monitor
- * @names_lock:		Well-known names lock
  * @names_list:		List of well-known names
  * @names_queue_list:	Well-known names this connection waits for
  * @names:		Number of owned well-known names
  * @work:		Support for poll()
+ * @free_work:		Frees the connection after the last reference
  * @timer:		Message reply timeout handling
- * @match_db:		Subscription filter to broadcast messages
- * @meta:		Cached connection creator's metadata/credentials
- * @msg_count:		Number of queued messages
- * @pool:		The user's buffer to receive messages
+ * @rcu:		Delays freeing for lockless lookups by ID
+ *
+ * The fields are grouped by who writes them, so that senders on other
+ * CPUs do not invalidate the cache lines the receiver works with: the
+ * first group is set up at HELLO and only read afterwards, the queue
+ * group is written by senders and the receiver alike, and the last
+ * group is used by the receiver and on the slow paths.
  */
 struct kdbus_conn {
-	struct kref kref;
-	bool disconnected;
+	struct percpu_ref ref;
+	atomic_t disconnected;
 	struct kdbus_ep *ep;
 	u64 id;
 	u64 flags;
 	u64 attach_flags;
-	struct mutex lock;
+	u64 memfd_inline_max;
+	u64 vec_memfd_min;
+	struct kdbus_pool *pool;
+	size_t pool_size;
+	struct kdbus_match_db *match_db;
+	struct kdbus_conn_status *status;
+	struct kdbus_meta *meta;
+	struct pid *pid;
+
+	struct mutex lock ____cacheline_aligned_in_smp;
 	struct list_head msg_list;
-	struct hlist_node hentry;
+	unsigned int msg_count;
+	size_t msg_bytes;
+	struct list_head reply_list;
+	unsigned int reply_count;
+
+	struct list_head lazy_list ____cacheline_aligned_in_smp;
+	struct kdbus_ring *ring;
+	struct kdbus_memfd_cache *memfd_cache;
 	struct list_head monitor_entry;
 	struct list_head names_list;
 	struct list_head names_queue_list;
 	size_t names;
 	struct work_struct work;
+	struct work_struct free_work;
 	struct timer_list timer;
-	struct kdbus_match_db *match_db;
-	struct kdbus_meta meta;
-	unsigned int msg_count;
-	struct kdbus_pool *pool;
+	struct rcu_head rcu;
 };
 
 struct kdbus_kmsg;
+struct kdbus_meta;
 struct kdbus_conn_queue;
 struct kdbus_name_registry;
+struct kdbus_memfd_cache;
 
 int kdbus_conn_new(struct kdbus_ep *ep,
 		   struct kdbus_cmd_hello *hello,
@@ -72,13 +106,24 @@ int kdbus_conn_new(struct kdbus_ep *ep,
 struct kdbus_conn *kdbus_conn_ref(struct kdbus_conn *conn);
 struct kdbus_conn *kdbus_conn_unref(struct kdbus_conn *conn);
 void kdbus_conn_disconnect(struct kdbus_conn *conn);
+int kdbus_conn_pool_init(struct kdbus_conn *conn);
 
-int kdbus_conn_recv_msg(struct kdbus_conn *conn, __u64 __user *buf);
+int kdbus_conn_recv_msg(struct kdbus_conn *conn, u64 flags, u64 *off);
+int kdbus_conn_install_fds(struct kdbus_conn *conn, u64 off);
+int kdbus_conn_free_range(struct kdbus_conn *conn, u64 off);
+bool kdbus_conn_busy_poll(struct kdbus_conn *conn, u64 usecs);
+void kdbus_conn_status_update(struct kdbus_conn *conn);
+int kdbus_conn_status_mmap(struct kdbus_conn *conn,
+			   struct vm_area_struct *vma);
 int kdbus_cmd_conn_info(struct kdbus_conn *conn,
 			void __user *buf);
 int kdbus_conn_kmsg_send(struct kdbus_ep *ep,
 			 struct kdbus_conn *conn_src,
 			 struct kdbus_kmsg *kmsg);
+int kdbus_conn_kmsg_send_conn(struct kdbus_ep *ep,
+			      struct kdbus_conn *conn_src,
+			      struct kdbus_conn *conn_dst,
+			      struct kdbus_kmsg *kmsg);
 void kdbus_conn_kmsg_list_free(struct list_head *kmsg_list);
 int kdbus_conn_kmsg_list_send(struct kdbus_ep *ep,
 			      struct kdbus_conn *conn_src,
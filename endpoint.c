@@ -54,7 +54,7 @@ static struct device_type kdbus_devtype_ep = {
 
 struct kdbus_ep *kdbus_ep_ref(struct kdbus_ep *ep)
 {
-	kref_get(&ep->kref);
+	percpu_ref_get(&ep->ref);
 	return ep;
 }
 
@@ -64,19 +64,16 @@ struct kdbus_ep *kdbus_ep_ref(struct kdbus_ep *ep)
  */
 void kdbus_ep_disconnect(struct kdbus_ep *ep)
 {
-	mutex_lock(&ep->lock);
-	if (ep->disconnected) {
-		mutex_unlock(&ep->lock);
+	if (atomic_xchg(&ep->disconnected, 1))
 		return;
-	}
 
-	ep->disconnected = true;
-	mutex_unlock(&ep->lock);
+	/* count in the shared atomic from now on, see kdbus_bus_disconnect() */
+	percpu_ref_get(&ep->ref);
+	percpu_ref_kill(&ep->ref);
 
 	/* disconnect from bus */
 	mutex_lock(&ep->bus->lock);
-	if (ep->bus)
-		list_del(&ep->bus_entry);
+	list_del(&ep->bus_entry);
 	mutex_unlock(&ep->bus->lock);
 
 	if (ep->dev) {
@@ -95,11 +92,10 @@ void kdbus_ep_disconnect(struct kdbus_ep *ep)
 	wake_up_interruptible(&ep->wait);
 }
 
-static void __kdbus_ep_free(struct kref *kref)
+static void __kdbus_ep_free(struct work_struct *work)
 {
-	struct kdbus_ep *ep = container_of(kref, struct kdbus_ep, kref);
+	struct kdbus_ep *ep = container_of(work, struct kdbus_ep, free_work);
 
-	kdbus_ep_disconnect(ep);
 	if (ep->policy_db)
 		kdbus_policy_db_free(ep->policy_db);
 	kdbus_bus_unref(ep->bus);
@@ -107,12 +103,19 @@ static void __kdbus_ep_free(struct kref *kref)
 	kfree(ep);
 }
 
+static void kdbus_ep_release(struct percpu_ref *ref)
+{
+	struct kdbus_ep *ep = container_of(ref, struct kdbus_ep, ref);
+
+	schedule_work(&ep->free_work);
+}
+
 struct kdbus_ep *kdbus_ep_unref(struct kdbus_ep *ep)
 {
 	if (!ep)
 		return NULL;
 
-	kref_put(&ep->kref, __kdbus_ep_free);
+	percpu_ref_put(&ep->ref);
 	return NULL;
 }
 
@@ -166,26 +169,36 @@ int kdbus_ep_new(struct kdbus_bus *bus, struct kdbus_ns *ns, const char *name,
 	if (!e)
 		return -ENOMEM;
 
+	ret = percpu_ref_init(&e->ref, kdbus_ep_release);
+	if (ret < 0) {
+		kfree(e);
+		return ret;
+	}
+
+	INIT_WORK(&e->free_work, __kdbus_ep_free);
 	mutex_init(&e->lock);
-	kref_init(&e->kref);
+	INIT_LIST_HEAD(&e->bus_entry);
+	e->bus = kdbus_bus_ref(bus);
 	e->uid = uid;
 	e->gid = gid;
 	e->mode = mode;
 	init_waitqueue_head(&e->wait);
 
 	e->name = kstrdup(name, GFP_KERNEL);
-	if (!e->name)
-		return -ENOMEM;
+	if (!e->name) {
+		ret = -ENOMEM;
+		goto exit;
+	}
 
-	mutex_lock(&ns->lock);
 	/* register minor in our endpoint map */
+	mutex_lock(&ns->lock);
 	i = idr_alloc(&ns->idr, e, 1, 0, GFP_KERNEL);
+	mutex_unlock(&ns->lock);
 	if (i <= 0) {
 		ret = i;
 		goto exit;
 	}
 	e->minor = i;
-	mutex_unlock(&ns->lock);
 
 	/* register bus endpoint device */
 	e->dev = kzalloc(sizeof(struct device), GFP_KERNEL);
@@ -216,12 +229,12 @@ int kdbus_ep_new(struct kdbus_bus *bus, struct kdbus_ns *ns, const char *name,
 	/* link into bus  */
 	mutex_lock(&bus->lock);
 	e->id = bus->ep_id_next++;
-	e->bus = kdbus_bus_ref(bus);
 	list_add_tail(&e->bus_entry, &bus->ep_list);
 	mutex_unlock(&bus->lock);
 	return 0;
 
 exit:
+	kdbus_ep_disconnect(e);
 	kdbus_ep_unref(e);
 	return ret;
 }
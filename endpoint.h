@@ -13,12 +13,16 @@
 #ifndef __KDBUS_EP_H
 #define __KDBUS_EP_H
 
+#include <linux/percpu-refcount.h>
+#include <linux/workqueue.h>
+
 #include "internal.h"
 
 /*
  * struct kdbus_endpoint - enpoint to access a bus
- * @kref		reference count
- * @disconnected	invalidated data
+ * @ref			reference count, per-CPU until disconnected
+ * @free_work		frees the endpoint after the last reference
+ * @disconnected	invalidated data, read without taking @lock
  * @bus			bus behind this endpoint
  * @name		name of the endpoint
  * @id			id of this endpoint on the bus
@@ -38,8 +42,9 @@
  * carry their own policies/filters.
  */
 struct kdbus_ep {
-	struct kref kref;
-	bool disconnected;
+	struct percpu_ref ref;
+	struct work_struct free_work;
+	atomic_t disconnected;
 	struct kdbus_bus *bus;
 	const char *name;
 	u64 id;
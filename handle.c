@@ -32,6 +32,7 @@
 #include "match.h"
 #include "names.h"
 #include "policy.h"
+#include "ring.h"
 #include "handle.h"
 
 enum kdbus_handle_type {
@@ -98,7 +99,7 @@ static int kdbus_handle_open(struct inode *inode, struct file *file)
 	/* find endpoint for device node */
 	mutex_lock(&handle->ns->lock);
 	ep = idr_find(&handle->ns->idr, MINOR(inode->i_rdev));
-	if (!ep || ep->disconnected) {
+	if (!ep || atomic_read(&ep->disconnected)) {
 		ret = -ESHUTDOWN;
 		goto exit_unlock;
 	}
@@ -250,7 +251,7 @@ static long kdbus_handle_ioctl_control(struct file *file, unsigned int cmd,
 		int fd;
 		int __user *addr = buf;
 
-		ret = kdbus_memfd_new(&fd);
+		ret = kdbus_memfd_new(NULL, &fd);
 		if (ret < 0)
 			break;
 
@@ -346,8 +347,10 @@ static long kdbus_handle_ioctl_ep(struct file *file, unsigned int cmd,
 			break;
 		}
 
-		if (hello->pool_size == 0 ||
-		    !IS_ALIGNED(hello->pool_size, PAGE_SIZE)) {
+		/* the pool size of send-only connections is ignored */
+		if (!(hello->conn_flags & KDBUS_HELLO_SEND_ONLY) &&
+		    (hello->pool_size == 0 ||
+		     !IS_ALIGNED(hello->pool_size, PAGE_SIZE))) {
 			ret = -EFAULT;
 			break;
 		}
@@ -386,6 +389,23 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 	struct kdbus_bus *bus = conn->ep->bus;
 	long ret = 0;
 
+	/*
+	 * The bus can tear the connection down while its owner still has
+	 * the file open; nothing may be linked to it anymore.
+	 */
+	if (atomic_read(&conn->disconnected))
+		return -ECONNRESET;
+
+	/* a send-only connection has no pool to return any data in */
+	if (conn->flags & KDBUS_HELLO_SEND_ONLY) {
+		switch (cmd) {
+		case KDBUS_CMD_NAME_ACQUIRE:
+		case KDBUS_CMD_NAME_LIST:
+		case KDBUS_CMD_CONN_INFO:
+			return -EOPNOTSUPP;
+		}
+	}
+
 	switch (cmd) {
 	case KDBUS_CMD_EP_POLICY_SET:
 		/* upload a policy for this endpoint */
@@ -487,9 +507,7 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 				break;
 			}
 
-			mutex_lock(&bus->lock);
 			mconn = kdbus_bus_find_conn_by_id(bus, cmd_monitor.id);
-			mutex_unlock(&bus->lock);
 		}
 
 		if (!mconn) {
@@ -497,12 +515,21 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 			break;
 		}
 
-		mutex_lock(&bus->lock);
-		if (cmd_monitor.flags & KDBUS_MONITOR_ENABLE)
+		if (mconn->flags & KDBUS_HELLO_SEND_ONLY) {
+			kdbus_conn_unref(mconn);
+			ret = -EOPNOTSUPP;
+			break;
+		}
+
+		/* kdbus_conn_disconnect() unlinks it with the same lock held */
+		down_write(&bus->monitors_lock);
+		if (atomic_read(&mconn->disconnected))
+			ret = -ECONNRESET;
+		else if (!(cmd_monitor.flags & KDBUS_MONITOR_ENABLE))
+			list_del_init(&mconn->monitor_entry);
+		else if (list_empty(&mconn->monitor_entry))
 			list_add_tail(&mconn->monitor_entry, &bus->monitors_list);
-		else
-			list_del(&mconn->monitor_entry);
-		mutex_unlock(&bus->lock);
+		up_write(&bus->monitors_lock);
 
 		//FIXME: keep ref around, we cannot add things to lists without pinning
 		kdbus_conn_unref(mconn);
@@ -529,13 +556,40 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 	}
 
 	case KDBUS_CMD_MSG_RECV: {
+		struct kdbus_cmd_recv cmd_recv;
+		u64 off;
+
 		/* receive a pointer to a queued message */
 		if (!KDBUS_IS_ALIGNED8((uintptr_t)buf)) {
 			ret = -EFAULT;
 			break;
 		}
 
-		ret = kdbus_conn_recv_msg(conn, buf);
+		if (copy_from_user(&cmd_recv, buf, sizeof(cmd_recv))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (!kdbus_check_flags(cmd_recv.flags)) {
+			ret = -ENOTSUPP;
+			break;
+		}
+
+		if (cmd_recv.flags & KDBUS_RECV_BUSY_POLL) {
+			if (cmd_recv.busy_poll_us > KDBUS_CONN_MAX_BUSY_POLL_US) {
+				ret = -EINVAL;
+				break;
+			}
+
+			kdbus_conn_busy_poll(conn, cmd_recv.busy_poll_us);
+		}
+
+		ret = kdbus_conn_recv_msg(conn, cmd_recv.flags, &off);
+		if (ret < 0)
+			break;
+
+		if (kdbus_offset_set_user(&off, buf, struct kdbus_cmd_recv))
+			ret = -EFAULT;
 		break;
 	}
 
@@ -553,9 +607,25 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 			break;
 		}
 
-		mutex_lock(&conn->lock);
-		ret = kdbus_pool_free_range(conn->pool, off);
-		mutex_unlock(&conn->lock);
+		ret = kdbus_conn_free_range(conn, off);
+		break;
+	}
+
+	case KDBUS_CMD_MSG_INSTALL_FDS: {
+		u64 off;
+
+		/* install the files of a message received lazily */
+		if (!KDBUS_IS_ALIGNED8((uintptr_t)buf)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (copy_from_user(&off, buf, sizeof(__u64))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = kdbus_conn_install_fds(conn, off);
 		break;
 	}
 
@@ -563,7 +633,7 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 		int fd;
 		int __user *addr = buf;
 
-		ret = kdbus_memfd_new(&fd);
+		ret = kdbus_memfd_new(conn->memfd_cache, &fd);
 		if (ret < 0)
 			break;
 
@@ -572,6 +642,26 @@ static long kdbus_handle_ioctl_ep_connected(struct file *file, unsigned int cmd,
 		break;
 	}
 
+	case KDBUS_CMD_RING_SETUP:
+		/* allocate the submission and completion rings */
+		if (!KDBUS_IS_ALIGNED8((uintptr_t)buf)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = kdbus_cmd_ring_setup(conn, buf);
+		break;
+
+	case KDBUS_CMD_RING_ENTER:
+		/* carry out the operations posted to the submission ring */
+		if (!KDBUS_IS_ALIGNED8((uintptr_t)buf)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = kdbus_cmd_ring_enter(conn, buf);
+		break;
+
 	default:
 		ret = -ENOTTY;
 		break;
@@ -607,7 +697,6 @@ static unsigned int kdbus_handle_poll(struct file *file,
 	struct kdbus_handle *handle = file->private_data;
 	struct kdbus_conn *conn;
 	unsigned int mask = 0;
-	bool disconnected;
 
 	/* Only an endpoint can read/write data */
 	if (handle->type != KDBUS_HANDLE_EP_CONNECTED)
@@ -617,32 +706,46 @@ static unsigned int kdbus_handle_poll(struct file *file,
 
 	poll_wait(file, &conn->ep->wait, wait);
 
-	mutex_lock(&conn->lock);
-
-	mutex_lock(&conn->ep->lock);
-	disconnected = conn->ep->disconnected;
-	mutex_unlock(&conn->ep->lock);
-
-	if (unlikely(disconnected))
+	/*
+	 * Neither value needs a lock; poll_wait() is in place before they
+	 * are read, so a change after the read will wake us up again.
+	 */
+	if (unlikely(atomic_read(&conn->ep->disconnected)))
 		mask |= POLLERR | POLLHUP;
-	else if (!list_empty(&conn->msg_list))
+	else if (ACCESS_ONCE(conn->msg_count) > 0)
 		mask |= POLLIN | POLLRDNORM;
 
-	mutex_unlock(&conn->lock);
-
 	return mask;
 }
 
 static int kdbus_handle_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct kdbus_handle *handle = file->private_data;
+	int ret;
 
 	if (handle->type != KDBUS_HANDLE_EP_CONNECTED)
 		return -EPERM;
 
+	if (vma->vm_pgoff == KDBUS_MMAP_OFF_NAMES >> PAGE_SHIFT)
+		return kdbus_name_dir_mmap(handle->ep->bus->name_registry, vma);
+
 	if (handle->conn->flags & KDBUS_HELLO_STARTER)
 		return -EPERM;
 
+	if (vma->vm_pgoff == KDBUS_MMAP_OFF_RING >> PAGE_SHIFT)
+		return kdbus_ring_mmap(handle->conn, vma);
+
+	/* a send-only connection has neither a status page nor a pool */
+	if (handle->conn->flags & KDBUS_HELLO_SEND_ONLY)
+		return -EPERM;
+
+	if (vma->vm_pgoff == KDBUS_MMAP_OFF_STATUS >> PAGE_SHIFT)
+		return kdbus_conn_status_mmap(handle->conn, vma);
+
+	ret = kdbus_conn_pool_init(handle->conn);
+	if (ret < 0)
+		return ret;
+
 	return kdbus_pool_mmap(handle->conn->pool, vma);
 }
 
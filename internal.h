@@ -31,8 +31,18 @@
 #define KDBUS_POLICY_MAX_SIZE		SZ_32K		/* maximum size of policy data */
 
 #define KDBUS_CONN_MAX_MSGS		64		/* maximum number of queued messages on the bus */
+#define KDBUS_KMSG_NOTIFY_RESERVE	64		/* notification messages kept in reserve */
 #define KDBUS_CONN_MAX_NAMES		64		/* maximum number of well-known names */
+#define KDBUS_NAME_DIR_MAX_ENTRIES	1024		/* maximum number of names in the name directory */
 #define KDBUS_CONN_MAX_ALLOCATED_BYTES	SZ_64K		/* maximum number of allocated bytes on the bus */
+#define KDBUS_CONN_MAX_BUSY_POLL_US	1000		/* maximum time to spin in RECV waiting for a message */
+#define KDBUS_CONN_MAX_MEMFD_INLINE	SZ_64K		/* maximum size of memfds to copy into the receiver's pool */
+#define KDBUS_CONN_MIN_VEC_MEMFD	SZ_64K		/* minimum size of vecs to pass in a memfd instead of the pool */
+#define KDBUS_CONN_MAX_MEMFD_CACHE	16		/* maximum number of closed memfds kept for reuse */
+#define KDBUS_CONN_REPLY_RESERVE_SIZE	SZ_4K		/* pool space kept free for every reserved reply */
+#define KDBUS_CONN_REPLY_GRACE_NS	(1ULL * NSEC_PER_SEC)	/* time a reservation outlives the call's timeout */
+
+#define KDBUS_RING_MAX_ENTRIES		4096		/* maximum number of entries in a submission/completion ring */
 
 /* all exported addresses are 64 bit */
 #define KDBUS_PTR(addr) ((void __user *)(uintptr_t)(addr))
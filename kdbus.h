@@ -317,10 +317,18 @@ struct kdbus_item {
  * 					message and the respective reply
  * @KDBUS_MSG_FLAGS_NO_AUTO_START:	Do not start a service, if the addressed
  * 					name is not currently active
+ * @KDBUS_MSG_FLAGS_RESERVE_REPLY:	Together with EXPECT_REPLY and a
+ * 					timeout, keep room for the reply in
+ * 					the sender's queue and pool until the
+ * 					reply arrives or the timeout passes
+ * @KDBUS_MSG_FLAGS_REPLY:		The message is a reply to the method
+ * 					call with the cookie in cookie_reply
  */
 enum kdbus_msg_flags {
 	KDBUS_MSG_FLAGS_EXPECT_REPLY	= 1 << 0,
 	KDBUS_MSG_FLAGS_NO_AUTO_START	= 1 << 1,
+	KDBUS_MSG_FLAGS_RESERVE_REPLY	= 1 << 2,
+	KDBUS_MSG_FLAGS_REPLY		= 1 << 3,
 };
 
 /**
@@ -341,10 +349,11 @@ enum kdbus_payload_type {
  * @src_id:		64-bit ID of the source connection
  * @payload_type:	Payload type (KDBUS_PAYLOAD_*)
  * @cookie:		Userspace-supplied cookie
- * @cookie_reply:	For kernel-generated messages, this is the cookie
- * 			the message is a reply to
- * @timeout_ns:		For non-kernel-generated messages, this denotes the
- * 			message timeout in nanoseconds
+ * @cookie_reply:	For kernel-generated messages and messages with
+ * 			KDBUS_MSG_FLAGS_REPLY, this is the cookie the
+ * 			message is a reply to
+ * @timeout_ns:		For other messages, this denotes the message
+ * 			timeout in nanoseconds
  * @items:		A list of kdbus_items containing the message payload
  */
 struct kdbus_msg {
@@ -361,6 +370,38 @@ struct kdbus_msg {
 	struct kdbus_item items[0];
 };
 
+/**
+ * enum kdbus_recv_flags - flags for de-queuing messages
+ * @KDBUS_RECV_BUSY_POLL:	If no message is queued, spin for up to
+ * 				@busy_poll_us microseconds waiting for one,
+ * 				before failing with -EAGAIN
+ * @KDBUS_RECV_LAZY_FDS:	Do not install passed file descriptors and
+ * 				memfds in the receiver's process; the fd
+ * 				numbers in the message are set to -1 until
+ * 				KDBUS_CMD_MSG_INSTALL_FDS is called for it
+ */
+enum kdbus_recv_flags {
+	KDBUS_RECV_BUSY_POLL		= 1 <<  0,
+	KDBUS_RECV_LAZY_FDS		= 1 <<  1,
+};
+
+/**
+ * struct kdbus_cmd_recv - struct to de-queue a message
+ * @flags:		KDBUS_RECV_* flags
+ * @busy_poll_us:	Maximum time to spin with KDBUS_RECV_BUSY_POLL,
+ * 			in microseconds
+ * @offset:		Returned offset in the pool where the message is
+ * 			stored. The user must use KDBUS_CMD_FREE to free
+ * 			the allocated memory.
+ *
+ * This struct is used with the KDBUS_CMD_MSG_RECV ioctl.
+ */
+struct kdbus_cmd_recv {
+	__u64 flags;
+	__u64 busy_poll_us;
+	__u64 offset;
+};
+
 /**
  * enum kdbus_policy_access_type - permissions of a policy record
  * @KDBUS_POLICY_ACCESS_USER:	Grant access to a uid
@@ -406,10 +447,14 @@ struct kdbus_cmd_policy {
  * 				by well-know name
  * @KDBUS_HELLO_ACCEPT_FD:	The connection allows the receiving of
  * 				any passed file descriptors
+ * @KDBUS_HELLO_SEND_ONLY:	The connection only sends messages which do
+ * 				not expect a reply; it has no pool and cannot
+ * 				receive anything
  */
 enum kdbus_hello_flags {
 	KDBUS_HELLO_STARTER		=  1 <<  0,
 	KDBUS_HELLO_ACCEPT_FD		=  1 <<  1,
+	KDBUS_HELLO_SEND_ONLY		=  1 <<  2,
 };
 
 /**
@@ -453,6 +498,15 @@ enum kdbus_attach_flags {
  * @bloom_size:		The bloom filter size chosen by the owner
  * 			(kernel → userspace)
  * @pool_size:		Maximum size of the pool buffer (kernel → userspace)
+ * @memfd_inline_max:	Sealed memfds passed with KDBUS_ITEM_PAYLOAD_MEMFD
+ * 			up to this size are copied into the pool and
+ * 			received as KDBUS_ITEM_PAYLOAD_OFF instead; 0 to
+ * 			always receive memfds as file descriptors
+ * @vec_memfd_min:	Data of KDBUS_ITEM_PAYLOAD_VEC items of at least
+ * 			this size is not copied into the pool, but into a
+ * 			new sealed memfd, which is received as
+ * 			KDBUS_ITEM_PAYLOAD_MEMFD instead; 0 to always
+ * 			receive vecs in the pool
  * @id128:		Unique 128-bit ID of the bus (kernel → userspace)
  * @items:		A list of items
  *
@@ -467,6 +521,8 @@ struct kdbus_cmd_hello {
 	__u64 id;
 	__u64 bloom_size;
 	__u64 pool_size;
+	__u64 memfd_inline_max;
+	__u64 vec_memfd_min;
 	__u8 id128[16];
 	struct kdbus_item items[0];
 };
@@ -476,6 +532,7 @@ enum kdbus_make_flags {
 	KDBUS_MAKE_ACCESS_GROUP		= 1 <<  0,
 	KDBUS_MAKE_ACCESS_WORLD		= 1 <<  1,
 	KDBUS_MAKE_POLICY_OPEN		= 1 <<  2,
+	KDBUS_MAKE_NAME_DIRECTORY	= 1 <<  3,
 };
 
 /**
@@ -708,6 +765,199 @@ struct kdbus_cmd_monitor {
 	__u64 flags;
 };
 
+/**
+ * enum kdbus_memfd_prealloc_flags - flags for memfd preallocation
+ * @KDBUS_MEMFD_PREALLOC_KEEP_SIZE:	Do not extend the size of the file
+ * 					if the range ends beyond it
+ */
+enum kdbus_memfd_prealloc_flags {
+	KDBUS_MEMFD_PREALLOC_KEEP_SIZE	= 1 <<  0,
+};
+
+/**
+ * struct kdbus_cmd_memfd_prealloc - struct to preallocate memfd pages
+ * @flags:		KDBUS_MEMFD_PREALLOC_* flags
+ * @offset:		Start of the range to allocate
+ * @size:		Size of the range to allocate
+ *
+ * This structure is used with the KDBUS_CMD_MEMFD_PREALLOC ioctl.
+ */
+struct kdbus_cmd_memfd_prealloc {
+	__u64 flags;
+	__u64 offset;
+	__u64 size;
+};
+
+/* mmap() offsets of the areas of a connection besides its pool */
+#define KDBUS_MMAP_OFF_RING		(1ULL << 40)
+#define KDBUS_MMAP_OFF_STATUS		(2ULL << 40)
+#define KDBUS_MMAP_OFF_NAMES		(3ULL << 40)
+
+/**
+ * struct kdbus_conn_status - read-only status page of a connection
+ * @seq:		Sequence counter, odd while an update is in progress
+ * @msg_count:		Number of messages queued for the connection
+ * @msg_bytes:		Pool space used by the queued messages
+ * @pool_free:		Pool space left for new messages and replies
+ *
+ * The kernel keeps the values up to date, mmap() the connection fd at
+ * KDBUS_MMAP_OFF_STATUS to read them without a syscall. To get a
+ * consistent snapshot, read @seq, retry while it is odd, read the
+ * values, and start over if @seq changed in the meantime.
+ */
+struct kdbus_conn_status {
+	__u64 seq;
+	__u64 msg_count;
+	__u64 msg_bytes;
+	__u64 pool_free;
+};
+
+/**
+ * struct kdbus_name_dir_entry - a slot in the name directory
+ * @id:			Connection ID of the owner, 0 if the slot is unused
+ * @flags:		KDBUS_NAME_* flags of the owner
+ * @name:		The well-known name, NUL-terminated
+ */
+struct kdbus_name_dir_entry {
+	__u64 id;
+	__u64 flags;
+	char name[256];
+};
+
+/* Flags for struct kdbus_name_dir */
+enum kdbus_name_dir_flags {
+	KDBUS_NAME_DIR_INCOMPLETE	= 1 <<  0,
+};
+
+/**
+ * struct kdbus_name_dir - directory of well-known names on a bus
+ * @seq:		Sequence counter, odd while an update is in progress
+ * @flags:		KDBUS_NAME_DIR_* flags
+ * @entries_max:	Number of slots in @entries
+ * @entries_used:	Slots up to this index may be in use
+ * @entries:		Array of slots
+ *
+ * Buses created with KDBUS_MAKE_NAME_DIRECTORY publish the owners of
+ * all well-known names in a read-only directory, which can be mapped
+ * from a connection fd at KDBUS_MMAP_OFF_NAMES. Lookups scan the first
+ * @entries_used slots; the same sequence counter protocol as for
+ * struct kdbus_conn_status applies. If KDBUS_NAME_DIR_INCOMPLETE is set,
+ * the directory ran out of slots, and names which are not found must be
+ * looked up with KDBUS_CMD_NAME_LIST instead.
+ */
+struct kdbus_name_dir {
+	__u64 seq;
+	__u64 flags;
+	__u64 entries_max;
+	__u64 entries_used;
+	struct kdbus_name_dir_entry entries[0];
+};
+
+/**
+ * enum kdbus_ring_op - operations of a submission ring entry
+ * @KDBUS_RING_OP_NOP:		Do nothing, complete with result 0
+ * @KDBUS_RING_OP_MSG_SEND:	Send the struct kdbus_msg at address @arg,
+ * 				like KDBUS_CMD_MSG_SEND
+ * @KDBUS_RING_OP_MSG_RECV:	Receive up to @arg queued messages, like
+ * 				KDBUS_CMD_MSG_RECV; zero receives as many as fit
+ * 				into the completion ring. Every message posts
+ * 				its own completion entry carrying the offset.
+ * @KDBUS_RING_OP_FREE:		Release the pool memory at offset @arg, like
+ * 				KDBUS_CMD_FREE
+ */
+enum kdbus_ring_op {
+	KDBUS_RING_OP_NOP,
+	KDBUS_RING_OP_MSG_SEND,
+	KDBUS_RING_OP_MSG_RECV,
+	KDBUS_RING_OP_FREE,
+};
+
+/**
+ * struct kdbus_ring_sqe - entry in the submission ring
+ * @opcode:		Operation to carry out (KDBUS_RING_OP_*)
+ * @flags:		Unused for now, must be zero
+ * @user_data:		Userspace supplied value, copied into the completion
+ * @arg:		Argument of the operation, see enum kdbus_ring_op
+ */
+struct kdbus_ring_sqe {
+	__u64 opcode;
+	__u64 flags;
+	__u64 user_data;
+	__u64 arg;
+};
+
+/**
+ * struct kdbus_ring_cqe - entry in the completion ring
+ * @user_data:		The value supplied in the submission entry
+ * @result:		Zero on success, negative errno on failure
+ * @offset:		For KDBUS_RING_OP_MSG_RECV, the offset of the received
+ * 			message in the pool
+ */
+struct kdbus_ring_cqe {
+	__u64 user_data;
+	__s64 result;
+	__u64 offset;
+};
+
+/**
+ * struct kdbus_ring_header - header of the mapped rings
+ * @sq_head:		Counter of consumed submissions (kernel → userspace)
+ * @sq_tail:		Counter of posted submissions (userspace → kernel)
+ * @cq_head:		Counter of consumed completions (userspace → kernel)
+ * @cq_tail:		Counter of posted completions (kernel → userspace)
+ * @sq_entries:		Number of submission entries, a power of two
+ * @cq_entries:		Number of completion entries, a power of two
+ * @sq_offset:		Offset of the struct kdbus_ring_sqe array
+ * @cq_offset:		Offset of the struct kdbus_ring_cqe array
+ *
+ * The header is located at the start of the area mapped at
+ * KDBUS_MMAP_OFF_RING. The counters only ever increase, the index into
+ * an array is the counter masked with the number of entries minus one.
+ */
+struct kdbus_ring_header {
+	__u64 sq_head;
+	__u64 sq_tail;
+	__u64 cq_head;
+	__u64 cq_tail;
+	__u64 sq_entries;
+	__u64 cq_entries;
+	__u64 sq_offset;
+	__u64 cq_offset;
+};
+
+/**
+ * struct kdbus_cmd_ring - struct to set up the rings of a connection
+ * @flags:		Unused for now, must be zero
+ * @sq_entries:		Number of submission entries, rounded up to a power
+ * 			of two; the actual value is returned
+ * @cq_entries:		Number of completion entries, rounded up to a power
+ * 			of two, zero picks twice @sq_entries; the actual value
+ * 			is returned
+ * @size:		The size of the area to mmap() at KDBUS_MMAP_OFF_RING
+ * 			(kernel → userspace)
+ *
+ * This structure is used with the KDBUS_CMD_RING_SETUP ioctl.
+ */
+struct kdbus_cmd_ring {
+	__u64 flags;
+	__u64 sq_entries;
+	__u64 cq_entries;
+	__u64 size;
+};
+
+/**
+ * struct kdbus_cmd_ring_enter - struct to process the submission ring
+ * @flags:		Unused for now, must be zero
+ * @submitted:		Number of consumed submission entries
+ * 			(kernel → userspace)
+ *
+ * This structure is used with the KDBUS_CMD_RING_ENTER ioctl.
+ */
+struct kdbus_cmd_ring_enter {
+	__u64 flags;
+	__u64 submitted;
+};
+
 /**
  * enum kdbus_ioctl_type - Ioctl API
  * @KDBUS_CMD_BUS_MAKE:		After opening the "control" device node, this
@@ -727,9 +977,15 @@ struct kdbus_cmd_monitor {
  * @KDBUS_CMD_MSG_SEND:		Send a message and pass data from userspace to
  * 				the kernel.
  * @KDBUS_CMD_MSG_RECV:		Receive a message from the kernel which is
- * 				placed in the receiver's pool.
+ * 				placed in the receiver's pool. Latency-critical
+ * 				receivers can ask to busy-poll for a message
+ * 				instead of going through poll().
  * @KDBUS_CMD_FREE:		Release the allocated memory in the receiver's
  * 				pool.
+ * @KDBUS_CMD_MSG_INSTALL_FDS:	Install the file descriptors of a message which
+ * 				was received with KDBUS_RECV_LAZY_FDS, given its
+ * 				offset in the pool. Messages freed before are
+ * 				dropped along with their files.
  * @KDBUS_CMD_NAME_ACQUIRE:	Request a well-known bus name to associate with
  * 				the connection. Well-known names are used to
  * 				address a peer on the bus.
@@ -777,6 +1033,17 @@ struct kdbus_cmd_monitor {
  * 				The current process needs to be the one and
  * 				single owner of the file, the sealing cannot
  * 				be changed as long as the file is shared.
+ * 				A memfd which was queued in a broadcast
+ * 				cannot be unsealed anymore.
+ * @KDBUS_CMD_MEMFD_PREALLOC:	Allocate the pages of a range of an unsealed
+ * 				file up front, so writing to it does not have
+ * 				to allocate them one by one.
+ * @KDBUS_CMD_RING_SETUP:	Allocate the submission and completion rings of
+ * 				a connection, which are mmap()ed at the offset
+ * 				KDBUS_MMAP_OFF_RING of the connection fd.
+ * @KDBUS_CMD_RING_ENTER:	Carry out all operations posted to the
+ * 				submission ring, as long as the completion ring
+ * 				has room for their results.
  */
 enum kdbus_ioctl_type {
 	KDBUS_CMD_BUS_MAKE =		_IOW (KDBUS_IOC_MAGIC, 0x00, struct kdbus_cmd_bus_make),
@@ -786,8 +1053,9 @@ enum kdbus_ioctl_type {
 	KDBUS_CMD_HELLO =		_IOWR(KDBUS_IOC_MAGIC, 0x30, struct kdbus_cmd_hello),
 
 	KDBUS_CMD_MSG_SEND =		_IOW (KDBUS_IOC_MAGIC, 0x40, struct kdbus_msg),
-	KDBUS_CMD_MSG_RECV =		_IOR (KDBUS_IOC_MAGIC, 0x41, __u64 *),
+	KDBUS_CMD_MSG_RECV =		_IOWR(KDBUS_IOC_MAGIC, 0x41, struct kdbus_cmd_recv),
 	KDBUS_CMD_FREE =		_IOW (KDBUS_IOC_MAGIC, 0x42, __u64 *),
+	KDBUS_CMD_MSG_INSTALL_FDS =	_IOW (KDBUS_IOC_MAGIC, 0x43, __u64 *),
 
 	KDBUS_CMD_NAME_ACQUIRE =	_IOWR(KDBUS_IOC_MAGIC, 0x50, struct kdbus_cmd_name),
 	KDBUS_CMD_NAME_RELEASE =	_IOW (KDBUS_IOC_MAGIC, 0x51, struct kdbus_cmd_name),
@@ -806,6 +1074,10 @@ enum kdbus_ioctl_type {
 	KDBUS_CMD_MEMFD_SIZE_SET =	_IOW (KDBUS_IOC_MAGIC, 0x92, __u64 *),
 	KDBUS_CMD_MEMFD_SEAL_GET =	_IOR (KDBUS_IOC_MAGIC, 0x93, int *),
 	KDBUS_CMD_MEMFD_SEAL_SET =	_IO  (KDBUS_IOC_MAGIC, 0x94),
+	KDBUS_CMD_MEMFD_PREALLOC =	_IOW (KDBUS_IOC_MAGIC, 0x95, struct kdbus_cmd_memfd_prealloc),
+
+	KDBUS_CMD_RING_SETUP =		_IOWR(KDBUS_IOC_MAGIC, 0xa0, struct kdbus_cmd_ring),
+	KDBUS_CMD_RING_ENTER =		_IOWR(KDBUS_IOC_MAGIC, 0xa1, struct kdbus_cmd_ring_enter),
 };
 
 /*
@@ -815,11 +1087,14 @@ enum kdbus_ioctl_type {
  * 			connection.
  * @EADDRNOTAVAIL:	A message flagged not to activate a service, addressed
  * 			a service which is not currently running.
- * @EAGAIN:		No messages are queued at the moment.
+ * @EAGAIN:		No messages are queued at the moment, or none arrived
+ * 			while busy-polling.
  * @EBADF:		File descriptors passed with the message are not valid.
  * @EBADFD:		A bus connection is in a corrupted state.
  * @EBADMSG:		Passed data contains a combination of conflicting or
  * 			inconsistent types.
+ * @EBUSY:		The completion ring is full, no submission could be
+ * 			carried out.
  * @ECOMM:		A peer does not accept the file descriptors addressed
  * 			to it.
  * @EDESTADDRREQ:	The well-known bus name is required but missing.
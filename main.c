@@ -22,15 +22,22 @@
 
 #include "internal.h"
 #include "namespace.h"
+#include "message.h"
 
 static int __init kdbus_init(void)
 {
 	int ret;
 
-	ret = subsys_virtual_register(&kdbus_subsys, NULL);
+	ret = kdbus_kmsg_init();
 	if (ret < 0)
 		return ret;
 
+	ret = subsys_virtual_register(&kdbus_subsys, NULL);
+	if (ret < 0) {
+		kdbus_kmsg_exit();
+		return ret;
+	}
+
 	/*
 	 * Create the initial namespace; it is world-accessible and
 	 * provides the /dev/kdbus/control device node.
@@ -38,6 +45,7 @@ static int __init kdbus_init(void)
 	ret = kdbus_ns_new(NULL, NULL, 0666, &kdbus_ns_init);
 	if (ret < 0) {
 		bus_unregister(&kdbus_subsys);
+		kdbus_kmsg_exit();
 		pr_err("failed to initialize ret=%i\n", ret);
 		return ret;
 	}
@@ -51,6 +59,7 @@ static void __exit kdbus_exit(void)
 	kdbus_ns_disconnect(kdbus_ns_init);
 	kdbus_ns_unref(kdbus_ns_init);
 	bus_unregister(&kdbus_subsys);
+	kdbus_kmsg_exit();
 }
 
 module_init(kdbus_init);
@@ -365,10 +365,7 @@ int kdbus_match_db_add(struct kdbus_conn *conn, void __user *buf)
 	if (cmd_match->id != 0 && cmd_match->id != conn->id) {
 		struct kdbus_bus *bus = conn->ep->bus;
 
-		mutex_lock(&bus->lock);
 		target_conn = kdbus_bus_find_conn_by_id(bus, cmd_match->id);
-		mutex_unlock(&bus->lock);
-
 		if (!target_conn) {
 			ret = -ENXIO;
 			goto exit_free;
@@ -379,6 +376,12 @@ int kdbus_match_db_add(struct kdbus_conn *conn, void __user *buf)
 		db = conn->match_db;
 	}
 
+	/* send-only connections do not receive broadcasts */
+	if (!db) {
+		ret = -EOPNOTSUPP;
+		goto exit_free;
+	}
+
 	e = kzalloc(sizeof(*e), GFP_KERNEL);
 	if (!e) {
 		ret = -ENOMEM;
@@ -484,10 +487,7 @@ int kdbus_match_db_remove(struct kdbus_conn *conn, void __user *buf)
 	if (cmd_match->id != 0 && cmd_match->id != conn->id) {
 		struct kdbus_bus *bus = conn->ep->bus;
 
-		mutex_lock(&bus->lock);
 		target_conn = kdbus_bus_find_conn_by_id(bus, cmd_match->id);
-		mutex_unlock(&bus->lock);
-
 		if (!target_conn) {
 			kfree(cmd_match);
 			return -ENXIO;
@@ -498,6 +498,12 @@ int kdbus_match_db_remove(struct kdbus_conn *conn, void __user *buf)
 		db = conn->match_db;
 	}
 
+	if (!db) {
+		kdbus_conn_unref(target_conn);
+		kfree(cmd_match);
+		return -EOPNOTSUPP;
+	}
+
 	mutex_lock(&db->entries_lock);
 	list_for_each_entry_safe(e, tmp, &db->entries_list, list_entry)
 		if (e->cookie == cmd_match->cookie &&
@@ -15,6 +15,7 @@
 #include <linux/sizes.h>
 #include <linux/sched.h>
 #include <linux/mutex.h>
+#include <linux/kref.h>
 #include <linux/init.h>
 #include <linux/aio.h>
 #include <linux/fs.h>
@@ -22,23 +23,184 @@
 #include <linux/mman.h>
 #include <linux/shmem_fs.h>
 #include <linux/anon_inodes.h>
+#include <linux/falloc.h>
 
 #include "memfd.h"
 
 static const struct file_operations kdbus_memfd_fops;
 
+/**
+ * struct kdbus_memfd_cache - unused memfds of a connection
+ * @kref:		Reference count, held by the connection and by
+ * 			every memfd which returns to the cache
+ * @lock:		Protects @list, @count and @dead
+ * @list:		Truncated and unsealed memfiles to reuse
+ * @count:		Number of entries in @list
+ * @dead:		The connection is gone, nothing is cached anymore
+ */
+struct kdbus_memfd_cache {
+	struct kref kref;
+	struct mutex lock;
+	struct list_head list;
+	unsigned int count;
+	bool dead;
+};
+
 /**
  * struct kdbus_memfile - protectable shared memory file
  * @sealed:		Flag if the content is writable
+ * @sent:		The memfd was queued in a broadcast, it stays sealed
  * @lock:		Locking
  * @fp:			Shared memory backing file
+ * @cache:		The cache to return to when the memfd is closed
+ * @entry:		Entry in the cache
  */
 struct kdbus_memfile {
 	bool sealed;
+	bool sent;
 	struct mutex lock;
 	struct file *fp;
+	struct kdbus_memfd_cache *cache;
+	struct list_head entry;
 };
 
+static void __kdbus_memfd_cache_free(struct kref *kref)
+{
+	struct kdbus_memfd_cache *cache =
+		container_of(kref, struct kdbus_memfd_cache, kref);
+
+	kfree(cache);
+}
+
+/**
+ * kdbus_memfd_cache_new() - create a cache of unused memfds
+ *
+ * Returns: the new cache, or NULL on failure
+ */
+struct kdbus_memfd_cache *kdbus_memfd_cache_new(void)
+{
+	struct kdbus_memfd_cache *cache;
+
+	cache = kzalloc(sizeof(struct kdbus_memfd_cache), GFP_KERNEL);
+	if (!cache)
+		return NULL;
+
+	kref_init(&cache->kref);
+	mutex_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->list);
+
+	return cache;
+}
+
+static void kdbus_memfile_free(struct kdbus_memfile *mf)
+{
+	fput(mf->fp);
+	if (mf->cache)
+		kref_put(&mf->cache->kref, __kdbus_memfd_cache_free);
+	kfree(mf);
+}
+
+/**
+ * kdbus_memfd_cache_free() - drop the connection's reference to a cache
+ * @cache:		The cache (may be NULL)
+ *
+ * The cached memfds are freed. Memfds still in use are freed when they
+ * are closed; the cache itself goes away with the last of them.
+ */
+void kdbus_memfd_cache_free(struct kdbus_memfd_cache *cache)
+{
+	struct kdbus_memfile *mf, *tmp;
+	LIST_HEAD(list);
+
+	if (!cache)
+		return;
+
+	mutex_lock(&cache->lock);
+	cache->dead = true;
+	list_splice_init(&cache->list, &list);
+	cache->count = 0;
+	mutex_unlock(&cache->lock);
+
+	list_for_each_entry_safe(mf, tmp, &list, entry)
+		kdbus_memfile_free(mf);
+
+	kref_put(&cache->kref, __kdbus_memfd_cache_free);
+}
+
+/* put a memfile back into its cache, or free it */
+static void kdbus_memfile_put(struct kdbus_memfile *mf)
+{
+	struct kdbus_memfd_cache *cache = mf->cache;
+
+	/* a mapping of the shmem file may still outlive the memfd */
+	if (!cache || file_count(mf->fp) != 1)
+		goto exit_free;
+
+	/* a reused memfd starts out empty and unsealed */
+	if (vfs_truncate(&mf->fp->f_path, 0) < 0)
+		goto exit_free;
+
+	mf->fp->f_pos = 0;
+	mf->sealed = false;
+	mf->sent = false;
+
+	mutex_lock(&cache->lock);
+	if (!cache->dead && cache->count < KDBUS_CONN_MAX_MEMFD_CACHE) {
+		list_add(&mf->entry, &cache->list);
+		cache->count++;
+		mf = NULL;
+	}
+	mutex_unlock(&cache->lock);
+
+	if (!mf)
+		return;
+
+exit_free:
+	kdbus_memfile_free(mf);
+}
+
+/* take a memfile from the cache, or allocate a new one */
+static struct kdbus_memfile *kdbus_memfile_get(struct kdbus_memfd_cache *cache)
+{
+	struct kdbus_memfile *mf = NULL;
+	struct file *shmemfp;
+
+	if (cache) {
+		mutex_lock(&cache->lock);
+		mf = list_first_entry_or_null(&cache->list,
+					      struct kdbus_memfile, entry);
+		if (mf) {
+			list_del(&mf->entry);
+			cache->count--;
+		}
+		mutex_unlock(&cache->lock);
+
+		if (mf)
+			return mf;
+	}
+
+	mf = kzalloc(sizeof(struct kdbus_memfile), GFP_KERNEL);
+	if (!mf)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_init(&mf->lock);
+
+	/* allocate a new unlinked shmem file */
+	shmemfp = shmem_file_setup("kdbus-memfd", 0, 0);
+	if (IS_ERR(shmemfp)) {
+		kfree(mf);
+		return ERR_CAST(shmemfp);
+	}
+	mf->fp = shmemfp;
+
+	if (cache) {
+		kref_get(&cache->kref);
+		mf->cache = cache;
+	}
+
+	return mf;
+}
+
 /**
  * kdbus_is_memfd() - check if a file is one of our memfds
  * @fp:			File to check
@@ -68,6 +230,30 @@ bool kdbus_is_memfd_sealed(const struct file *fp)
 	return sealed;
 }
 
+/**
+ * kdbus_memfd_seal_pin() - check if a memfd is protected, and keep it so
+ * @fp:			Memfd file to check
+ *
+ * A memfd which is queued in a broadcast is shared by the queues of all
+ * its receivers; once a sealed memfd passed this check, nobody can unseal
+ * it anymore, neither the sender nor any of the receivers.
+ *
+ * Returns: true if the memfd is protected
+ */
+bool kdbus_memfd_seal_pin(const struct file *fp)
+{
+	struct kdbus_memfile *mf = fp->private_data;
+	bool sealed;
+
+	mutex_lock(&mf->lock);
+	sealed = mf->sealed;
+	if (sealed)
+		mf->sent = true;
+	mutex_unlock(&mf->lock);
+
+	return sealed;
+}
+
 /**
  * kdbus_memfd_size() - return the actual size of a memfd
  * @fp:			Memfd file to check
@@ -87,38 +273,29 @@ u64 kdbus_memfd_size(const struct file *fp)
 }
 
 /**
- * kdbus_memfd_new() - create and install a memfd and file descriptor
- * @fd:			installed file descriptor
+ * kdbus_memfd_shmem() - return the shared memory file backing a memfd
+ * @fp:			Memfd file
  *
- * Returns: 0 on success, negative errno on failure.
+ * The returned file is only valid as long as a reference to @fp is held.
+ *
+ * Returns: the backing file
  */
-int kdbus_memfd_new(int *fd)
+struct file *kdbus_memfd_shmem(const struct file *fp)
 {
-	struct kdbus_memfile *mf;
-	struct file *shmemfp;
-	struct file *fp;
-	int f;
-	int ret;
-
-	mf = kzalloc(sizeof(struct kdbus_memfile), GFP_KERNEL);
-	if (!mf)
-		return -ENOMEM;
+	struct kdbus_memfile *mf = fp->private_data;
 
-	mutex_init(&mf->lock);
+	return mf->fp;
+}
 
-	/* allocate a new unlinked shmem file */
-	shmemfp = shmem_file_setup("kdbus-memfd", 0, 0);
-	if (IS_ERR(shmemfp)) {
-		ret = PTR_ERR(shmemfp);
-		goto exit;
-	}
-	mf->fp = shmemfp;
+/* create a new memfd file, not yet installed in any process */
+static struct file *kdbus_memfd_file_new(struct kdbus_memfd_cache *cache)
+{
+	struct kdbus_memfile *mf;
+	struct file *fp;
 
-	f = get_unused_fd_flags(O_CLOEXEC);
-	if (f < 0) {
-		ret = f;
-		goto exit_shmem;
-	}
+	mf = kdbus_memfile_get(cache);
+	if (IS_ERR(mf))
+		return ERR_CAST(mf);
 
 	/* The anonymous exported inode ops cannot reach the otherwise
 	 * invisible shmem inode. We rely on the fact that nothing else
@@ -126,32 +303,79 @@ int kdbus_memfd_new(int *fd)
 	 * fd in /proc/$PID/fd/ */
 	fp = anon_inode_getfile("[kdbus]", &kdbus_memfd_fops, mf, O_RDWR);
 	if (IS_ERR(fp)) {
-		ret = PTR_ERR(fp);
-		goto exit_fd;
+		kdbus_memfile_put(mf);
+		return fp;
 	}
 
 	fp->f_mode |= FMODE_LSEEK|FMODE_PREAD|FMODE_PWRITE;
-	fp->f_mapping = shmemfp->f_mapping;
+	fp->f_mapping = mf->fp->f_mapping;
+	return fp;
+}
+
+/**
+ * kdbus_memfd_new() - create and install a memfd and file descriptor
+ * @cache:		Cache to reuse a memfd from and to return it to
+ * 			when closed (may be NULL)
+ * @fd:			installed file descriptor
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_memfd_new(struct kdbus_memfd_cache *cache, int *fd)
+{
+	struct file *fp;
+	int f;
+
+	f = get_unused_fd_flags(O_CLOEXEC);
+	if (f < 0)
+		return f;
+
+	fp = kdbus_memfd_file_new(cache);
+	if (IS_ERR(fp)) {
+		put_unused_fd(f);
+		return PTR_ERR(fp);
+	}
+
 	fd_install(f, fp);
 
 	*fd = f;
 	return 0;
+}
 
-exit_fd:
-	put_unused_fd(f);
-exit_shmem:
-	fput(shmemfp);
-exit:
-	kfree(mf);
-	return ret;
+/**
+ * kdbus_memfd_new_from_user() - create a sealed memfd from user memory
+ * @data:		User memory to copy into the memfd
+ * @len:		Number of bytes to copy
+ *
+ * The memfd is not installed in any process. Since nobody else can
+ * have a reference to it yet, it is sealed right away.
+ *
+ * Returns: the new memfd file, or an ERR_PTR() on failure
+ */
+struct file *kdbus_memfd_new_from_user(const void __user *data, size_t len)
+{
+	struct kdbus_memfile *mf;
+	struct file *fp;
+	loff_t pos = 0;
+	ssize_t n;
+
+	fp = kdbus_memfd_file_new(NULL);
+	if (IS_ERR(fp))
+		return fp;
+
+	mf = fp->private_data;
+	n = mf->fp->f_op->write(mf->fp, data, len, &pos);
+	if (n != len) {
+		fput(fp);
+		return ERR_PTR(n < 0 ? n : -EFAULT);
+	}
+
+	mf->sealed = true;
+	return fp;
 }
 
 static int kdbus_memfd_release(struct inode *ignored, struct file *file)
 {
-	struct kdbus_memfile *mf = file->private_data;
-
-	fput(mf->fp);
-	kfree(mf);
+	kdbus_memfile_put(file->private_data);
 	return 0;
 }
 
@@ -160,7 +384,12 @@ static loff_t kdbus_memfd_llseek(struct file *file, loff_t offset, int whence)
 	struct kdbus_memfile *mf = file->private_data;
 	loff_t ret;
 
+	/*
+	 * The position lives in the anonymous file; the shmem file only
+	 * borrows it while it is seeking.
+	 */
 	mutex_lock(&mf->lock);
+	mf->fp->f_pos = file->f_pos;
 	ret = mf->fp->f_op->llseek(mf->fp, offset, whence);
 	if (ret < 0)
 		goto exit;
@@ -177,20 +406,14 @@ static ssize_t kdbus_memfd_readv(struct kiocb *iocb, const struct iovec *iov,
 				 unsigned long iov_count, loff_t pos)
 {
 	struct kdbus_memfile *mf = iocb->ki_filp->private_data;
-	ssize_t ret;
 
-	mutex_lock(&mf->lock);
+	/*
+	 * Reading only uses the position passed in, which the VFS stores
+	 * in the anonymous file, or not at all for pread(). Nothing shared
+	 * needs to be locked; readers of a sealed memfd run in parallel.
+	 */
 	iocb->ki_filp = mf->fp;
-	ret = mf->fp->f_op->aio_read(iocb, iov, iov_count, pos);
-	if (ret < 0)
-		goto exit;
-
-	/* update the shmem file */
-	mf->fp->f_pos = iocb->ki_pos;
-
-exit:
-	mutex_unlock(&mf->lock);
-	return ret;
+	return mf->fp->f_op->aio_read(iocb, iov, iov_count, pos);
 }
 
 static ssize_t kdbus_memfd_writev(struct kiocb *iocb, const struct iovec *iov,
@@ -209,17 +432,75 @@ static ssize_t kdbus_memfd_writev(struct kiocb *iocb, const struct iovec *iov,
 
 	iocb->ki_filp = mf->fp;
 	ret = mf->fp->f_op->aio_write(iocb, iov, iov_count, pos);
-	if (ret < 0)
-		goto exit;
-
-	/* update the shmem file */
-	mf->fp->f_pos = iocb->ki_pos;
 
 exit:
 	mutex_unlock(&mf->lock);
 	return ret;
 }
 
+static ssize_t kdbus_memfd_splice_read(struct file *file, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t len, unsigned int flags)
+{
+	struct kdbus_memfile *mf = file->private_data;
+
+	/* like reading, this only uses the position passed in */
+	return mf->fp->f_op->splice_read(mf->fp, ppos, pipe, len, flags);
+}
+
+static ssize_t kdbus_memfd_splice_write(struct pipe_inode_info *pipe,
+					struct file *file, loff_t *ppos,
+					size_t len, unsigned int flags)
+{
+	struct kdbus_memfile *mf = file->private_data;
+	struct file *fp;
+	ssize_t ret;
+
+	/*
+	 * The splice can wait for data in an empty pipe as long as it
+	 * likes, it must not hold the lock meanwhile. The reference to
+	 * the shmem file makes KDBUS_CMD_MEMFD_SEAL_SET fail until the
+	 * splice is done.
+	 */
+	mutex_lock(&mf->lock);
+	if (mf->sealed) {
+		mutex_unlock(&mf->lock);
+		return -EPERM;
+	}
+
+	fp = get_file(mf->fp);
+	mutex_unlock(&mf->lock);
+
+	ret = fp->f_op->splice_write(pipe, fp, ppos, len, flags);
+	fput(fp);
+
+	return ret;
+}
+
+/* allocate the pages of a range, must be called with mf->lock held */
+static long kdbus_memfd_alloc(struct kdbus_memfile *mf, int mode,
+			      loff_t offset, loff_t len)
+{
+	/* deny write access to a sealed file */
+	if (mf->sealed)
+		return -EPERM;
+
+	return mf->fp->f_op->fallocate(mf->fp, mode, offset, len);
+}
+
+static long kdbus_memfd_fallocate(struct file *file, int mode,
+				  loff_t offset, loff_t len)
+{
+	struct kdbus_memfile *mf = file->private_data;
+	long ret;
+
+	mutex_lock(&mf->lock);
+	ret = kdbus_memfd_alloc(mf, mode, offset, len);
+	mutex_unlock(&mf->lock);
+
+	return ret;
+}
+
 static int kdbus_memfd_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct kdbus_memfile *mf = file->private_data;
@@ -333,7 +614,10 @@ kdbus_memfd_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		 * when accessing mf->sealed.
 		 */
 		down_read(&mm->mmap_sem);
-		if (file_count(mf->fp) != 1) {
+		if (mf->sent && !argp) {
+			/* the content may still be queued for receivers */
+			ret = -EPERM;
+		} else if (file_count(mf->fp) != 1) {
 			if (mf->sealed == !!argp)
 				ret = -EALREADY;
 			else
@@ -345,6 +629,33 @@ kdbus_memfd_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		up_read(&mm->mmap_sem);
 		break;
 	}
+
+	case KDBUS_CMD_MEMFD_PREALLOC: {
+		struct kdbus_cmd_memfd_prealloc cmd;
+		int mode = 0;
+
+		if (copy_from_user(&cmd, argp, sizeof(cmd))) {
+			ret = -EFAULT;
+			goto exit;
+		}
+
+		if (cmd.flags & ~KDBUS_MEMFD_PREALLOC_KEEP_SIZE) {
+			ret = -ENOTSUPP;
+			goto exit;
+		}
+
+		if (cmd.size == 0 || cmd.offset > LLONG_MAX ||
+		    cmd.size > LLONG_MAX - cmd.offset) {
+			ret = -EINVAL;
+			goto exit;
+		}
+
+		if (cmd.flags & KDBUS_MEMFD_PREALLOC_KEEP_SIZE)
+			mode |= FALLOC_FL_KEEP_SIZE;
+
+		ret = kdbus_memfd_alloc(mf, mode, cmd.offset, cmd.size);
+		break;
+	}
 default:
 		ret = -ENOTTY;
 		break;
@@ -361,6 +672,9 @@ static const struct file_operations kdbus_memfd_fops = {
 	.aio_read =		kdbus_memfd_readv,
 	.aio_write =		kdbus_memfd_writev,
 	.llseek =		kdbus_memfd_llseek,
+	.splice_read =		kdbus_memfd_splice_read,
+	.splice_write =		kdbus_memfd_splice_write,
+	.fallocate =		kdbus_memfd_fallocate,
 	.mmap =			kdbus_memfd_mmap,
 	.unlocked_ioctl =	kdbus_memfd_ioctl,
 #ifdef CONFIG_COMPAT
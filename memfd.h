@@ -15,8 +15,15 @@
 
 #include "internal.h"
 
+struct kdbus_memfd_cache;
+
+struct kdbus_memfd_cache *kdbus_memfd_cache_new(void);
+void kdbus_memfd_cache_free(struct kdbus_memfd_cache *cache);
 bool kdbus_is_memfd(const struct file *fp);
 bool kdbus_is_memfd_sealed(const struct file *fp);
+bool kdbus_memfd_seal_pin(const struct file *fp);
 u64 kdbus_memfd_size(const struct file *fp);
-int kdbus_memfd_new(int *fd);
+struct file *kdbus_memfd_shmem(const struct file *fp);
+int kdbus_memfd_new(struct kdbus_memfd_cache *cache, int *fd);
+struct file *kdbus_memfd_new_from_user(const void __user *data, size_t len);
 #endif
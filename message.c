@@ -23,6 +23,7 @@
 #include <linux/cred.h>
 #include <linux/capability.h>
 #include <linux/sizes.h>
+#include <linux/mempool.h>
 
 #include "message.h"
 #include "connection.h"
@@ -31,9 +32,51 @@
 #include "policy.h"
 #include "names.h"
 #include "match.h"
+#include "memfd.h"
 
 #define KDBUS_KMSG_HEADER_SIZE offsetof(struct kdbus_kmsg, msg)
 
+/* the largest notification carries a name change with the longest name */
+#define KDBUS_KMSG_NOTIFY_SIZE \
+	(sizeof(struct kdbus_kmsg) + \
+	 KDBUS_ITEM_SIZE(sizeof(struct kdbus_notify_name_change) + \
+			 KDBUS_NAME_MAX_LEN + 1))
+
+static struct kmem_cache *kdbus_kmsg_cache;
+static mempool_t *kdbus_kmsg_pool;
+
+/**
+ * kdbus_kmsg_init() - set up the reserve of notification messages
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_kmsg_init(void)
+{
+	kdbus_kmsg_cache = kmem_cache_create("kdbus_kmsg",
+					     KDBUS_KMSG_NOTIFY_SIZE, 0, 0,
+					     NULL);
+	if (!kdbus_kmsg_cache)
+		return -ENOMEM;
+
+	kdbus_kmsg_pool = mempool_create_slab_pool(KDBUS_KMSG_NOTIFY_RESERVE,
+						   kdbus_kmsg_cache);
+	if (!kdbus_kmsg_pool) {
+		kmem_cache_destroy(kdbus_kmsg_cache);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * kdbus_kmsg_exit() - release the reserve of notification messages
+ */
+void kdbus_kmsg_exit(void)
+{
+	mempool_destroy(kdbus_kmsg_pool);
+	kmem_cache_destroy(kdbus_kmsg_cache);
+}
+
 static void __maybe_unused kdbus_msg_dump(const struct kdbus_msg *msg)
 {
 	const struct kdbus_item *item;
@@ -77,8 +120,21 @@ static void __maybe_unused kdbus_msg_dump(const struct kdbus_msg *msg)
  */
 void kdbus_kmsg_free(struct kdbus_kmsg *kmsg)
 {
+	unsigned int i;
+
+	if (kmsg->memfds) {
+		for (i = 0; i < kmsg->memfds_count; i++)
+			if (kmsg->memfds[i])
+				fput(kmsg->memfds[i]);
+		kfree(kmsg->memfds);
+	}
+
 	kdbus_meta_free(&kmsg->meta);
-	kfree(kmsg);
+
+	if (kmsg->pooled)
+		mempool_free(kmsg, kdbus_kmsg_pool);
+	else
+		kfree(kmsg);
 }
 
 /**
@@ -86,6 +142,11 @@ void kdbus_kmsg_free(struct kdbus_kmsg *kmsg)
  * @extra_size:		additional size to reserve for data
  * @m:			Returned Message
  *
+ * Messages which fit the size of a notification fall back to a reserve
+ * if the allocation fails. They never wait for the reserve to be
+ * refilled; notifications are created with connection locks held, and
+ * only the delivery which needs these locks gives the elements back.
+ *
  * Returns: 0 on success, negative errno on failure.
  */
 int kdbus_kmsg_new(size_t extra_size, struct kdbus_kmsg **m)
@@ -94,9 +155,19 @@ int kdbus_kmsg_new(size_t extra_size, struct kdbus_kmsg **m)
 	struct kdbus_kmsg *kmsg;
 
 	size = sizeof(struct kdbus_kmsg) + KDBUS_ITEM_SIZE(extra_size);
-	kmsg = kzalloc(size, GFP_KERNEL);
-	if (!kmsg)
-		return -ENOMEM;
+	if (size <= KDBUS_KMSG_NOTIFY_SIZE) {
+		kmsg = mempool_alloc(kdbus_kmsg_pool,
+				     GFP_NOWAIT | __GFP_NOWARN);
+		if (!kmsg)
+			return -ENOMEM;
+
+		memset(kmsg, 0, size);
+		kmsg->pooled = true;
+	} else {
+		kmsg = kzalloc(size, GFP_KERNEL);
+		if (!kmsg)
+			return -ENOMEM;
+	}
 
 	kmsg->msg.size = size - KDBUS_KMSG_HEADER_SIZE;
 	kmsg->msg.items[0].size = KDBUS_ITEM_SIZE(extra_size);
@@ -157,10 +228,6 @@ static int kdbus_msg_scan_items(struct kdbus_conn *conn, struct kdbus_kmsg *kmsg
 					  sizeof(struct kdbus_memfd))
 				return -EINVAL;
 
-			/* do not allow to broadcast file descriptors */
-			if (msg->dst_id == KDBUS_DST_ID_BROADCAST)
-				return -ENOTUNIQ;
-
 			if (item->memfd.fd < 0)
 				return -EBADF;
 
@@ -263,6 +330,72 @@ static int kdbus_msg_scan_items(struct kdbus_conn *conn, struct kdbus_kmsg *kmsg
 	return 0;
 }
 
+/* Validate the state of the incoming PAYLOAD_MEMFD, and grab a reference
+ * to put it into the receivers' queues. */
+static int kdbus_msg_memfd_ref(const struct kdbus_item *item,
+			       struct file **file)
+{
+	struct file *fp;
+	int ret;
+
+	fp = fget(item->memfd.fd);
+	if (!fp)
+		return -EBADF;
+
+	/*
+	 * We only accept kdbus_memfd files as payload, other files need to
+	 * be passed with KDBUS_MSG_FDS.
+	 */
+	if (!kdbus_is_memfd(fp)) {
+		ret = -EMEDIUMTYPE;
+		goto exit_unref;
+	}
+
+	/* We only accept a sealed memfd file whose content cannot be altered
+	 * by the sender or anybody else while it is shared or in-flight. */
+	if (!kdbus_is_memfd_sealed(fp)) {
+		ret = -ETXTBSY;
+		goto exit_unref;
+	}
+
+	/* The specified size in the item cannot be larger than the file. */
+	if (item->memfd.size > kdbus_memfd_size(fp)) {
+		ret = -EBADF;
+		goto exit_unref;
+	}
+
+	*file = fp;
+	return 0;
+
+exit_unref:
+	fput(fp);
+	return ret;
+}
+
+/* resolve the memfds once, they are shared by all receivers */
+static int kdbus_kmsg_memfds_ref(struct kdbus_kmsg *kmsg)
+{
+	const struct kdbus_item *item;
+	unsigned int i = 0;
+	int ret;
+
+	kmsg->memfds = kcalloc(kmsg->memfds_count, sizeof(struct file *),
+			       GFP_KERNEL);
+	if (!kmsg->memfds)
+		return -ENOMEM;
+
+	KDBUS_ITEM_FOREACH(item, &kmsg->msg, items) {
+		if (item->type != KDBUS_ITEM_PAYLOAD_MEMFD)
+			continue;
+
+		ret = kdbus_msg_memfd_ref(item, &kmsg->memfds[i++]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
 /**
  * kdbus_kmsg_new_from_user() - copy message from user memory
  * @conn:		Connection
@@ -300,11 +433,39 @@ int kdbus_kmsg_new_from_user(struct kdbus_conn *conn,
 		goto exit_free;
 	}
 
+	/* a send-only connection could not receive the reply */
+	if ((kmsg->msg.flags & KDBUS_MSG_FLAGS_EXPECT_REPLY) &&
+	    (conn->flags & KDBUS_HELLO_SEND_ONLY)) {
+		ret = -EOPNOTSUPP;
+		goto exit_free;
+	}
+
+	/* room for a reply is only kept until the call times out */
+	if ((kmsg->msg.flags & KDBUS_MSG_FLAGS_RESERVE_REPLY) &&
+	    (!(kmsg->msg.flags & KDBUS_MSG_FLAGS_EXPECT_REPLY) ||
+	     kmsg->msg.timeout_ns == 0)) {
+		ret = -EINVAL;
+		goto exit_free;
+	}
+
+	/* a reply carries cookie_reply where a call has its timeout */
+	if ((kmsg->msg.flags & KDBUS_MSG_FLAGS_REPLY) &&
+	    (kmsg->msg.flags & KDBUS_MSG_FLAGS_EXPECT_REPLY)) {
+		ret = -EINVAL;
+		goto exit_free;
+	}
+
 	/* check validity and gather some values for processing */
 	ret = kdbus_msg_scan_items(conn, kmsg);
 	if (ret < 0)
 		goto exit_free;
 
+	if (kmsg->memfds_count > 0) {
+		ret = kdbus_kmsg_memfds_ref(kmsg);
+		if (ret < 0)
+			goto exit_free;
+	}
+
 	/* patch-in the source of this message */
 	kmsg->msg.src_id = conn->id;
 
@@ -28,6 +28,8 @@
  * @vecs_size:		Size of PAYLOAD data
  * @vecs_count:		Number of PAYLOAD vectors
  * @memfds_count:	Number of memfds to pass
+ * @memfds:		Sealed memfd files to pass, shared by all receivers
+ * @pooled:		Allocated from the reserve of notification messages
  * @queue_entry:	List of kernel-generated notifications
  * @msg:		Message from or to userspace
  */
@@ -42,6 +44,8 @@ struct kdbus_kmsg {
 	size_t vecs_size;
 	unsigned int vecs_count;
 	unsigned int memfds_count;
+	struct file **memfds;
+	bool pooled;
 	struct list_head queue_entry;
 
 	/* variable size, must be the last member */
@@ -51,6 +55,8 @@ struct kdbus_kmsg {
 struct kdbus_ep;
 struct kdbus_conn;
 
+int kdbus_kmsg_init(void);
+void kdbus_kmsg_exit(void);
 int kdbus_kmsg_new(size_t extra_size, struct kdbus_kmsg **m);
 int kdbus_kmsg_new_from_user(struct kdbus_conn *conn, struct kdbus_msg __user *msg, struct kdbus_kmsg **m);
 void kdbus_kmsg_free(struct kdbus_kmsg *kmsg);
@@ -189,9 +189,10 @@ static int kdbus_meta_append_src_names(struct kdbus_meta *meta,
 	return ret;
 }
 
-static int kdbus_meta_append_exe(struct kdbus_meta *meta)
+static int kdbus_meta_append_exe(struct kdbus_meta *meta,
+				 struct task_struct *task)
 {
-	struct mm_struct *mm = get_task_mm(current);
+	struct mm_struct *mm = get_task_mm(task);
 	struct path *exe_path = NULL;
 	int ret = 0;
 
@@ -230,29 +231,46 @@ static int kdbus_meta_append_exe(struct kdbus_meta *meta)
 	return ret;
 }
 
-static int kdbus_meta_append_cmdline(struct kdbus_meta *meta)
+static int kdbus_meta_append_cmdline(struct kdbus_meta *meta,
+				     struct task_struct *task)
 {
-	struct mm_struct *mm = current->mm;
+	struct mm_struct *mm;
 	char *tmp;
 	int ret = 0;
 
+	mm = get_task_mm(task);
+	if (!mm)
+		return 0;
+
 	tmp = (char *) __get_free_page(GFP_TEMPORARY | __GFP_ZERO);
-	if (!tmp)
+	if (!tmp) {
+		mmput(mm);
 		return -ENOMEM;
+	}
 
-	if (mm && mm->arg_end) {
+	if (mm->arg_end) {
 		size_t len = mm->arg_end - mm->arg_start;
+		size_t copied;
 
 		if (len > PAGE_SIZE)
 			len = PAGE_SIZE;
 
-		ret = copy_from_user(tmp, (const char __user *) mm->arg_start, len);
-		if (ret == 0)
+		/* the creator of a connection is not necessarily current */
+		if (task == current)
+			copied = len - copy_from_user(tmp,
+					(const char __user *) mm->arg_start,
+					len);
+		else
+			copied = access_process_vm(task, mm->arg_start,
+						   tmp, len, 0);
+
+		if (copied == len)
 			ret = kdbus_meta_append_data(meta, KDBUS_ITEM_CMDLINE,
 						     tmp, len);
 	}
 
 	free_page((unsigned long) tmp);
+	mmput(mm);
 	return ret;
 }
 
@@ -284,7 +302,8 @@ static int kdbus_meta_append_caps(struct kdbus_meta *meta)
 }
 
 #ifdef CONFIG_CGROUPS
-static int kdbus_meta_append_cgroup(struct kdbus_meta *meta)
+static int kdbus_meta_append_cgroup(struct kdbus_meta *meta,
+				    struct task_struct *task)
 {
 	char *tmp;
 	int ret;
@@ -293,7 +312,7 @@ static int kdbus_meta_append_cgroup(struct kdbus_meta *meta)
 	if (!tmp)
 		return -ENOMEM;
 
-	ret = task_cgroup_path(current, tmp, PAGE_SIZE);
+	ret = task_cgroup_path(task, tmp, PAGE_SIZE);
 	if (ret >= 0)
 		ret = kdbus_meta_append_str(meta, KDBUS_ITEM_CGROUP, tmp);
 
@@ -346,6 +365,84 @@ static int kdbus_meta_append_seclabel(struct kdbus_meta *meta)
 }
 #endif
 
+/**
+ * kdbus_meta_append_task() - collect metadata which describes a task
+ * @meta:		Metadata object
+ * @task:		Task to collect the data from
+ * @which:		KDBUS_ATTACH_* flags; only EXE, CMDLINE and CGROUP
+ *			are handled here
+ *
+ * Unlike the credentials, these items can be read from a task other than
+ * current; connections use this to collect them from their creator only
+ * when somebody asks for them.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_meta_append_task(struct kdbus_meta *meta,
+			   struct task_struct *task,
+			   u64 which)
+{
+	int ret = 0;
+
+	if (which & KDBUS_ATTACH_EXE &&
+	    !(meta->attached & KDBUS_ATTACH_EXE)) {
+		ret = kdbus_meta_append_exe(meta, task);
+		if (ret < 0)
+			return ret;
+
+		meta->attached |= KDBUS_ATTACH_EXE;
+	}
+
+	if (which & KDBUS_ATTACH_CMDLINE &&
+	    !(meta->attached & KDBUS_ATTACH_CMDLINE)) {
+		ret = kdbus_meta_append_cmdline(meta, task);
+		if (ret < 0)
+			return ret;
+
+		meta->attached |= KDBUS_ATTACH_CMDLINE;
+	}
+
+#ifdef CONFIG_CGROUPS
+	/* attach the path of the one group hierarchy specified for the bus */
+	if (which & KDBUS_ATTACH_CGROUP &&
+	    !(meta->attached & KDBUS_ATTACH_CGROUP)) {
+		ret = kdbus_meta_append_cgroup(meta, task);
+		if (ret < 0)
+			return ret;
+
+		meta->attached |= KDBUS_ATTACH_CGROUP;
+	}
+#endif
+
+	return ret;
+}
+
+/**
+ * kdbus_meta_merge() - add the items of another metadata object
+ * @meta:		Metadata object to extend
+ * @from:		Metadata object to copy the items from
+ *
+ * This allows to collect metadata into a private object first, and to
+ * add it to a shared one in a single step.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_meta_merge(struct kdbus_meta *meta, const struct kdbus_meta *from)
+{
+	struct kdbus_item *item;
+
+	if (from->size > 0) {
+		item = kdbus_meta_append_item(meta, from->size);
+		if (IS_ERR(item))
+			return PTR_ERR(item);
+
+		memcpy(item, from->data, from->size);
+	}
+
+	meta->attached |= from->attached;
+	return 0;
+}
+
 /**
  * kdbus_meta_append() - collect metadata from current process
  * @meta:		Metadata object
@@ -415,24 +512,9 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 		meta->attached |= KDBUS_ATTACH_COMM;
 	}
 
-	if (which & KDBUS_ATTACH_EXE &&
-	    !(meta->attached & KDBUS_ATTACH_EXE)) {
-
-		ret = kdbus_meta_append_exe(meta);
-		if (ret < 0)
-			goto exit;
-
-		meta->attached |= KDBUS_ATTACH_EXE;
-	}
-
-	if (which & KDBUS_ATTACH_CMDLINE &&
-	    !(meta->attached & KDBUS_ATTACH_CMDLINE)) {
-		ret = kdbus_meta_append_cmdline(meta);
-		if (ret < 0)
-			goto exit;
-
-		meta->attached |= KDBUS_ATTACH_CMDLINE;
-	}
+	ret = kdbus_meta_append_task(meta, current, which);
+	if (ret < 0)
+		goto exit;
 
 	/* we always return a 4 elements, the element size is 1/4  */
 	if (which & KDBUS_ATTACH_CAPS &&
@@ -444,18 +526,6 @@ int kdbus_meta_append(struct kdbus_meta *meta,
 		meta->attached |= KDBUS_ATTACH_CAPS;
 	}
 
-#ifdef CONFIG_CGROUPS
-	/* attach the path of the one group hierarchy specified for the bus */
-	if (which & KDBUS_ATTACH_CGROUP &&
-	    !(meta->attached & KDBUS_ATTACH_CGROUP)) {
-		ret = kdbus_meta_append_cgroup(meta);
-		if (ret < 0)
-			goto exit;
-
-		meta->attached |= KDBUS_ATTACH_CGROUP;
-	}
-#endif
-
 #ifdef CONFIG_AUDITSYSCALL
 	if (which & KDBUS_ATTACH_AUDIT &&
 	    !(meta->attached & KDBUS_ATTACH_AUDIT)) {
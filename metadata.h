@@ -36,9 +36,14 @@ struct kdbus_meta {
 };
 
 struct kdbus_conn;
+struct task_struct;
 
 int kdbus_meta_append(struct kdbus_meta *meta,
 		      struct kdbus_conn *conn,
 		      u64 which);
+int kdbus_meta_append_task(struct kdbus_meta *meta,
+			   struct task_struct *task,
+			   u64 which);
+int kdbus_meta_merge(struct kdbus_meta *meta, const struct kdbus_meta *from);
 void kdbus_meta_free(struct kdbus_meta *meta);
 #endif
@@ -21,6 +21,8 @@
 #include <linux/hash.h>
 #include <linux/uaccess.h>
 #include <linux/ctype.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 
 #include "names.h"
 #include "connection.h"
@@ -45,8 +47,131 @@ struct kdbus_name_queue_item {
 	struct list_head	conn_entry;
 };
 
-static void kdbus_name_entry_free(struct kdbus_name_entry *e)
+/*
+ * The name directory is written with entries_lock held, which makes sure
+ * there is only one writer of the sequence counter at a time.
+ */
+static void kdbus_name_dir_write_begin(struct kdbus_name_dir *dir)
+{
+	ACCESS_ONCE(dir->seq) = dir->seq + 1;
+	smp_wmb();
+}
+
+static void kdbus_name_dir_write_end(struct kdbus_name_dir *dir)
+{
+	smp_wmb();
+	ACCESS_ONCE(dir->seq) = dir->seq + 1;
+}
+
+static void kdbus_name_dir_set_flags(struct kdbus_name_registry *reg)
+{
+	if (reg->dir_missing > 0)
+		reg->dir->flags |= KDBUS_NAME_DIR_INCOMPLETE;
+	else
+		reg->dir->flags &= ~KDBUS_NAME_DIR_INCOMPLETE;
+}
+
+/* publish the current owner of a name in the directory */
+static void kdbus_name_dir_update(struct kdbus_name_registry *reg,
+				  struct kdbus_name_entry *e)
+{
+	struct kdbus_name_dir_entry *d;
+
+	if (!reg->dir || e->dir_slot < 0)
+		return;
+
+	d = &reg->dir->entries[e->dir_slot];
+
+	kdbus_name_dir_write_begin(reg->dir);
+	d->id = e->conn ? e->conn->id : 0;
+	d->flags = e->flags;
+	kdbus_name_dir_write_end(reg->dir);
+}
+
+/* give a new name a slot in the directory */
+static void kdbus_name_dir_add(struct kdbus_name_registry *reg,
+			       struct kdbus_name_entry *e)
+{
+	struct kdbus_name_dir_entry *d;
+	int slot;
+
+	e->dir_slot = -1;
+	if (!reg->dir)
+		return;
+
+	slot = ida_simple_get(&reg->dir_ida, 0, KDBUS_NAME_DIR_MAX_ENTRIES,
+			      GFP_KERNEL);
+
+	kdbus_name_dir_write_begin(reg->dir);
+	if (slot < 0) {
+		/* the name can still be used, it is just not listed */
+		reg->dir_missing++;
+		kdbus_name_dir_set_flags(reg);
+	} else {
+		e->dir_slot = slot;
+		d = &reg->dir->entries[slot];
+		d->id = e->conn ? e->conn->id : 0;
+		d->flags = e->flags;
+		strlcpy(d->name, e->name, sizeof(d->name));
+
+		if (slot >= reg->dir->entries_used)
+			reg->dir->entries_used = slot + 1;
+	}
+	kdbus_name_dir_write_end(reg->dir);
+}
+
+static void kdbus_name_dir_remove(struct kdbus_name_registry *reg,
+				  struct kdbus_name_entry *e)
+{
+	struct kdbus_name_dir_entry *d;
+
+	if (!reg->dir)
+		return;
+
+	kdbus_name_dir_write_begin(reg->dir);
+	if (e->dir_slot < 0) {
+		reg->dir_missing--;
+		kdbus_name_dir_set_flags(reg);
+	} else {
+		d = &reg->dir->entries[e->dir_slot];
+		d->id = 0;
+		d->flags = 0;
+		memset(d->name, 0, sizeof(d->name));
+	}
+	kdbus_name_dir_write_end(reg->dir);
+
+	if (e->dir_slot >= 0)
+		ida_simple_remove(&reg->dir_ida, e->dir_slot);
+}
+
+/**
+ * kdbus_name_dir_mmap() - map the name directory into the process
+ * @reg:		The name registry
+ * @vma:		passed by mmap() syscall
+ *
+ * Returns: the result of the mmap() call, negative errno on failure.
+ */
+int kdbus_name_dir_mmap(struct kdbus_name_registry *reg,
+			struct vm_area_struct *vma)
 {
+	if (!reg->dir)
+		return -ENXIO;
+
+	/* the directory is only written by the kernel */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	if ((vma->vm_end - vma->vm_start) > reg->dir_size)
+		return -EFAULT;
+
+	return remap_vmalloc_range(vma, reg->dir, 0);
+}
+
+static void kdbus_name_entry_free(struct kdbus_name_registry *reg,
+				  struct kdbus_name_entry *e)
+{
+	kdbus_name_dir_remove(reg, e);
 	hash_del(&e->hentry);
 	kfree(e->name);
 	kfree(e);
@@ -66,19 +191,22 @@ void kdbus_name_registry_free(struct kdbus_name_registry *reg)
 
 	mutex_lock(&reg->entries_lock);
 	hash_for_each_safe(reg->entries_hash, i, tmp, e, hentry)
-		kdbus_name_entry_free(e);
+		kdbus_name_entry_free(reg, e);
 	mutex_unlock(&reg->entries_lock);
 
+	ida_destroy(&reg->dir_ida);
+	vfree(reg->dir);
 	kfree(reg);
 }
 
 /**
  * kdbus_name_registry_new() - create a new name registry
  * @reg:		The returned name registry
+ * @dir:		Publish the names in a directory shared with userspace
  *
  * Returns 0 on success, -ENOMEM if memory allocation failed.
  */
-int kdbus_name_registry_new(struct kdbus_name_registry **reg)
+int kdbus_name_registry_new(struct kdbus_name_registry **reg, bool dir)
 {
 	struct kdbus_name_registry *r;
 
@@ -88,6 +216,20 @@ int kdbus_name_registry_new(struct kdbus_name_registry **reg)
 
 	hash_init(r->entries_hash);
 	mutex_init(&r->entries_lock);
+	ida_init(&r->dir_ida);
+
+	if (dir) {
+		r->dir_size = PAGE_ALIGN(sizeof(struct kdbus_name_dir) +
+					 KDBUS_NAME_DIR_MAX_ENTRIES *
+					 sizeof(struct kdbus_name_dir_entry));
+		r->dir = vmalloc_user(r->dir_size);
+		if (!r->dir) {
+			kfree(r);
+			return -ENOMEM;
+		}
+
+		r->dir->entries_max = KDBUS_NAME_DIR_MAX_ENTRIES;
+	}
 
 	*reg = r;
 
@@ -141,7 +283,8 @@ static void kdbus_name_entry_set_owner(struct kdbus_name_entry *e,
 	mutex_unlock(&conn->lock);
 }
 
-static void kdbus_name_entry_release(struct kdbus_name_entry *e,
+static void kdbus_name_entry_release(struct kdbus_name_registry *reg,
+				     struct kdbus_name_entry *e,
 				     struct list_head *notification_list)
 {
 	struct kdbus_name_queue_item *q;
@@ -157,6 +300,7 @@ static void kdbus_name_entry_release(struct kdbus_name_entry *e,
 						 notification_list);
 			kdbus_name_entry_remove_owner(e);
 			kdbus_name_entry_set_owner(e, e->starter);
+			kdbus_name_dir_update(reg, e);
 			return;
 		}
 
@@ -167,7 +311,7 @@ static void kdbus_name_entry_release(struct kdbus_name_entry *e,
 					 e->flags, e->name,
 					 notification_list);
 		kdbus_name_entry_remove_owner(e);
-		kdbus_name_entry_free(e);
+		kdbus_name_entry_free(reg, e);
 		return;
 	}
 
@@ -182,9 +326,11 @@ static void kdbus_name_entry_release(struct kdbus_name_entry *e,
 	kdbus_name_entry_remove_owner(e);
 	kdbus_name_entry_set_owner(e, q->conn);
 	kdbus_name_queue_item_free(q);
+	kdbus_name_dir_update(reg, e);
 }
 
-static int kdbus_name_release(struct kdbus_name_entry *e,
+static int kdbus_name_release(struct kdbus_name_registry *reg,
+			      struct kdbus_name_entry *e,
 			      struct kdbus_conn *conn,
 			      struct list_head *notification_list)
 {
@@ -192,7 +338,7 @@ static int kdbus_name_release(struct kdbus_name_entry *e,
 
 	/* Is the connection already the real owner of the name? */
 	if (e->conn == conn) {
-		kdbus_name_entry_release(e, notification_list);
+		kdbus_name_entry_release(reg, e, notification_list);
 		return 0;
 	}
 
@@ -226,17 +372,27 @@ void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 	LIST_HEAD(notification_list);
 	LIST_HEAD(names_queue_list);
 	LIST_HEAD(names_list);
+	struct list_head *notify = &notification_list;
 
+	/* nobody is left to be told about the names of a dead bus */
+	if (atomic_read(&conn->ep->bus->disconnected))
+		notify = NULL;
+
+	/*
+	 * The connection is already marked as disconnected, and
+	 * kdbus_name_acquire() checks that with entries_lock held; no
+	 * name or queue entry can be added after the lists are taken.
+	 */
+	mutex_lock(&reg->entries_lock);
 	mutex_lock(&conn->lock);
 	list_splice_init(&conn->names_list, &names_list);
 	list_splice_init(&conn->names_queue_list, &names_queue_list);
 	mutex_unlock(&conn->lock);
 
-	mutex_lock(&reg->entries_lock);
 	list_for_each_entry_safe(q, q_tmp, &names_queue_list, conn_entry)
 		kdbus_name_queue_item_free(q);
 	list_for_each_entry_safe(e, e_tmp, &names_list, conn_entry)
-		kdbus_name_entry_release(e, &notification_list);
+		kdbus_name_entry_release(reg, e, notify);
 	mutex_unlock(&reg->entries_lock);
 
 	kdbus_conn_kmsg_list_send(conn->ep, NULL, &notification_list);
@@ -321,6 +477,7 @@ static int kdbus_name_handle_conflict(struct kdbus_name_registry *reg,
 		kdbus_name_entry_remove_owner(e);
 		kdbus_name_entry_set_owner(e, conn);
 		e->flags = *flags;
+		kdbus_name_dir_update(reg, e);
 		return 0;
 	}
 
@@ -404,11 +561,19 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 	hash = kdbus_str_hash(name);
 
 	mutex_lock(&reg->entries_lock);
+
+	/* see kdbus_name_remove_by_conn() */
+	if (atomic_read(&conn->disconnected)) {
+		ret = -ECONNRESET;
+		goto exit_unlock;
+	}
+
 	e = __kdbus_name_lookup(reg, hash, name);
 	if (e) {
 		if (e->conn == conn) {
 			//FIXME: weird API? data change + error return?
 			e->flags = flags;
+			kdbus_name_dir_update(reg, e);
 			ret = -EALREADY;
 			goto exit_unlock;
 		}
@@ -445,6 +610,7 @@ int kdbus_name_acquire(struct kdbus_name_registry *reg,
 	INIT_LIST_HEAD(&e->queue_list);
 	hash_add(reg->entries_hash, &e->hentry, hash);
 	kdbus_name_entry_set_owner(e, conn);
+	kdbus_name_dir_add(reg, e);
 
 	kdbus_notify_name_change(e->conn->ep, KDBUS_ITEM_NAME_ADD, 0,
 				 e->conn->id, e->flags, e->name,
@@ -508,10 +674,7 @@ int kdbus_cmd_name_acquire(struct kdbus_name_registry *reg,
 			goto exit_free;
 		}
 
-		mutex_lock(&bus->lock);
 		new_conn = kdbus_bus_find_conn_by_id(bus, cmd_name->id);
-		mutex_unlock(&bus->lock);
-
 		if (!new_conn) {
 			ret = -ENXIO;
 			goto exit_free;
@@ -541,7 +704,9 @@ int kdbus_cmd_name_acquire(struct kdbus_name_registry *reg,
 	if (copy_to_user(buf, cmd_name, size)) {
 		ret = -EFAULT;
 		kdbus_conn_kmsg_list_free(&notification_list);
-		kdbus_name_entry_release(e, NULL);
+		mutex_lock(&reg->entries_lock);
+		kdbus_name_entry_release(reg, e, NULL);
+		mutex_unlock(&reg->entries_lock);
 	}
 
 exit_unref_conn:
@@ -608,10 +773,7 @@ int kdbus_cmd_name_release(struct kdbus_name_registry *reg,
 			goto exit_unlock;
 		}
 
-		mutex_lock(&bus->lock);
 		conn = kdbus_bus_find_conn_by_id(bus, cmd_name->id);
-		mutex_unlock(&bus->lock);
-
 		if (!conn) {
 			ret = -ENXIO;
 			goto exit_unlock;
@@ -620,7 +782,7 @@ int kdbus_cmd_name_release(struct kdbus_name_registry *reg,
 		kdbus_conn_ref(conn);
 	}
 
-	ret = kdbus_name_release(e, conn, &notification_list);
+	ret = kdbus_name_release(reg, e, conn, &notification_list);
 
 exit_unlock:
 	mutex_unlock(&reg->entries_lock);
@@ -683,15 +845,19 @@ static int kdbus_name_list_write(struct kdbus_conn *conn,
 static int kdbus_name_list_all(struct kdbus_conn *conn, u64 flags,
 			       size_t *pos, bool write)
 {
+	struct kdbus_bus *bus = conn->ep->bus;
 	size_t p = *pos;
-	int i;
+	struct radix_tree_iter iter;
+	void **slot;
 	struct kdbus_conn *c;
 	int ret;
 
-	hash_for_each(conn->ep->bus->conn_hash, i, c, hentry) {
+	radix_tree_for_each_slot(slot, &bus->conn_tree, &iter, 0) {
 		struct kdbus_name_entry *e;
 		bool added = false;
 
+		c = kdbus_bus_conn_slot(bus, slot);
+
 		/* skip starters */
 		if (!(flags & KDBUS_NAME_LIST_STARTERS) &&
 		    c->flags & KDBUS_HELLO_STARTER)
@@ -758,7 +924,13 @@ int kdbus_cmd_name_list(struct kdbus_name_registry *reg,
 	if (IS_ERR(cmd_list))
 		return PTR_ERR(cmd_list);
 
-	mutex_lock(&conn->ep->bus->lock);
+	ret = kdbus_conn_pool_init(conn);
+	if (ret < 0) {
+		kfree(cmd_list);
+		return ret;
+	}
+
+	mutex_lock(&conn->ep->bus->conn_lock);
 	mutex_lock(&reg->entries_lock);
 
 	/* size of header */
@@ -798,8 +970,14 @@ exit_unlock:
 	if (ret < 0)
 		kdbus_pool_free_range(conn->pool, off);
 	mutex_unlock(&reg->entries_lock);
-	mutex_unlock(&conn->ep->bus->lock);
+	mutex_unlock(&conn->ep->bus->conn_lock);
 	kfree(cmd_list);
 
+	if (ret == 0) {
+		mutex_lock(&conn->lock);
+		kdbus_conn_status_update(conn);
+		mutex_unlock(&conn->lock);
+	}
+
 	return ret;
 }
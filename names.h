@@ -14,15 +14,24 @@
 #define __KDBUS_NAMES_H
 
 #include <linux/hashtable.h>
+#include <linux/idr.h>
 
 /**
  * struct kdbus_name_registry - names registered for a bus
  * @entries_hash:	Map of entries
  * @entries_lock:	Registry data lock
+ * @dir:		Optional name directory shared read-only with userspace
+ * @dir_size:		Size of @dir
+ * @dir_ida:		Allocated slots in @dir
+ * @dir_missing:	Number of names which did not get a slot in @dir
  */
 struct kdbus_name_registry {
 	DECLARE_HASHTABLE(entries_hash, 6);
 	struct mutex		entries_lock;
+	struct kdbus_name_dir	*dir;
+	size_t			dir_size;
+	struct ida		dir_ida;
+	unsigned int		dir_missing;
 };
 
 /**
@@ -34,6 +43,7 @@ struct kdbus_name_registry {
  * @hentry:		Entry in registry map
  * @conn:		Connection owning the name
  * @starter:		Connection of the starter queuing incoming messages
+ * @dir_slot:		Slot in the name directory, or -1
  */
 struct kdbus_name_entry {
 	char			*name;
@@ -43,9 +53,10 @@ struct kdbus_name_entry {
 	struct hlist_node	hentry;
 	struct kdbus_conn	*conn;
 	struct kdbus_conn	*starter;
+	int			dir_slot;
 };
 
-int kdbus_name_registry_new(struct kdbus_name_registry **reg);
+int kdbus_name_registry_new(struct kdbus_name_registry **reg, bool dir);
 void kdbus_name_registry_free(struct kdbus_name_registry *reg);
 
 int kdbus_name_acquire(struct kdbus_name_registry *reg,
@@ -67,5 +78,8 @@ struct kdbus_name_entry *kdbus_name_lookup(struct kdbus_name_registry *reg,
 void kdbus_name_remove_by_conn(struct kdbus_name_registry *reg,
 			       struct kdbus_conn *conn);
 
+int kdbus_name_dir_mmap(struct kdbus_name_registry *reg,
+			struct vm_area_struct *vma);
+
 bool kdbus_name_is_valid(const char *p);
 #endif
@@ -34,9 +34,7 @@ static int kdbus_notify_reply(struct kdbus_ep *ep, u64 src_id,
 	struct kdbus_item *item;
 	int ret;
 
-	mutex_lock(&ep->bus->lock);
 	dst_conn = kdbus_bus_find_conn_by_id(ep->bus, src_id);
-	mutex_unlock(&ep->bus->lock);
 
 	if (!dst_conn)
 		return -ENXIO;
@@ -60,7 +58,8 @@ static int kdbus_notify_reply(struct kdbus_ep *ep, u64 src_id,
 	item = kmsg->msg.items;
 	item->type = msg_type;
 
-	ret = kdbus_conn_kmsg_send(ep, NULL, kmsg);
+	/* deliver to the connection we already hold */
+	ret = kdbus_conn_kmsg_send_conn(ep, NULL, dst_conn, kmsg);
 	kdbus_kmsg_free(kmsg);
 
 exit_unref_conn:
@@ -130,7 +129,7 @@ int kdbus_notify_name_change(struct kdbus_ep *ep, u64 type,
 	if (!queue_list)
 		return 0;
 
-	extra_size = sizeof(*name_change) + strlen(name);
+	extra_size = sizeof(*name_change) + strlen(name) + 1;
 	ret = kdbus_kmsg_new(extra_size, &kmsg);
 	if (ret < 0)
 		return ret;
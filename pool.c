@@ -488,7 +488,7 @@ kdbus_pool_copy(struct file *f_dst, size_t off_dst,
 		if (data)
 			ret = kdbus_pool_copy_data(p, o, data + dpos, n);
 		else
-			ret = kdbus_pool_copy_file(p, o, f_src, off_src, n);
+			ret = kdbus_pool_copy_file(p, o, f_src, off_src + dpos, n);
 		mark_page_accessed(p);
 
 		status = aops->write_end(f_dst, mapping, fpos, n, n, p, fsdata);
@@ -554,6 +554,33 @@ ssize_t kdbus_pool_write(const struct kdbus_pool *pool, size_t off,
 	return ret;
 }
 
+/**
+ * kdbus_pool_write_file() - copy the content of a file to the pool
+ * @pool:		The receiver's pool
+ * @off:		Offset of allocated memory
+ * @f:			File to read from, it must implement f_op->read
+ * @f_off:		Offset in the file to start reading at
+ * @len:		Number of bytes to copy
+ *
+ * The offset was returned by the call to kdbus_pool_alloc_range(). The
+ * file position of @f is not changed.
+ *
+ * Returns: the numbers of bytes copied, negative errno on failure.
+ */
+ssize_t kdbus_pool_write_file(const struct kdbus_pool *pool, size_t off,
+			      struct file *f, size_t f_off, size_t len)
+{
+	mm_segment_t old_fs;
+	ssize_t ret;
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	ret = kdbus_pool_copy(pool->f, off, NULL, f, f_off, len);
+	set_fs(old_fs);
+
+	return ret;
+}
+
 /**
  * kdbus_pool_write() - move memory from one pool into another one
  * @dst_pool:		The receiver's pool to copy to
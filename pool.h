@@ -25,6 +25,8 @@ ssize_t kdbus_pool_write(const struct kdbus_pool *pool, size_t off,
 			 void *data, size_t len);
 ssize_t kdbus_pool_write_user(const struct kdbus_pool *pool, size_t off,
 			 void __user *data, size_t len);
+ssize_t kdbus_pool_write_file(const struct kdbus_pool *pool, size_t off,
+			      struct file *f, size_t f_off, size_t len);
 int kdbus_pool_move(struct kdbus_pool *dst_pool,
 		    struct kdbus_pool *src_pool,
 		    size_t *offset, size_t size);
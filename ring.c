@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2013 Kay Sievers
+ * Copyright (C) 2013 Greg Kroah-Hartman <gregkh@linuxfoundation.org>
+ * Copyright (C) 2013 Daniel Mack <daniel@zonque.org>
+ * Copyright (C) 2013 Linux Foundation
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sizes.h>
+#include <linux/mutex.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/uaccess.h>
+
+#include "connection.h"
+#include "message.h"
+#include "endpoint.h"
+#include "pool.h"
+#include "ring.h"
+
+/**
+ * struct kdbus_ring - submission and completion rings of a connection
+ * @lock:		Serializes the consumers of the submission ring
+ * @mem:		Memory shared with userspace
+ * @size:		Size of @mem
+ * @hdr:		The header at the start of @mem
+ * @sqes:		Array of submission entries
+ * @cqes:		Array of completion entries
+ * @sq_entries:		Number of submission entries
+ * @cq_entries:		Number of completion entries
+ * @sq_head:		Counter of consumed submissions
+ * @cq_tail:		Counter of posted completions
+ *
+ * Userspace can write to the entire shared memory at any time. The
+ * counters the kernel relies on are kept in the private @sq_head and
+ * @cq_tail, and only copied into the header; values read back from the
+ * shared memory are never trusted.
+ */
+struct kdbus_ring {
+	struct mutex lock;
+	void *mem;
+	size_t size;
+	struct kdbus_ring_header *hdr;
+	struct kdbus_ring_sqe *sqes;
+	struct kdbus_ring_cqe *cqes;
+	u64 sq_entries;
+	u64 cq_entries;
+	u64 sq_head;
+	u64 cq_tail;
+};
+
+static int kdbus_ring_new(u64 sq_entries, u64 cq_entries,
+			  struct kdbus_ring **ring)
+{
+	struct kdbus_ring *r;
+	size_t sq_off, cq_off;
+
+	r = kzalloc(sizeof(struct kdbus_ring), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	sq_off = sizeof(struct kdbus_ring_header);
+	cq_off = sq_off + sq_entries * sizeof(struct kdbus_ring_sqe);
+	r->size = PAGE_ALIGN(cq_off + cq_entries * sizeof(struct kdbus_ring_cqe));
+
+	r->mem = vmalloc_user(r->size);
+	if (!r->mem) {
+		kfree(r);
+		return -ENOMEM;
+	}
+
+	mutex_init(&r->lock);
+	r->hdr = r->mem;
+	r->sqes = r->mem + sq_off;
+	r->cqes = r->mem + cq_off;
+	r->sq_entries = sq_entries;
+	r->cq_entries = cq_entries;
+
+	r->hdr->sq_entries = sq_entries;
+	r->hdr->cq_entries = cq_entries;
+	r->hdr->sq_offset = sq_off;
+	r->hdr->cq_offset = cq_off;
+
+	*ring = r;
+	return 0;
+}
+
+/**
+ * kdbus_ring_free() - destroy rings
+ * @ring:		The rings of a connection (may be NULL)
+ */
+void kdbus_ring_free(struct kdbus_ring *ring)
+{
+	if (!ring)
+		return;
+
+	vfree(ring->mem);
+	kfree(ring);
+}
+
+/* number of completions which can be posted without overwriting any */
+static u64 kdbus_ring_cq_space(const struct kdbus_ring *ring)
+{
+	u64 used;
+
+	used = ring->cq_tail - ACCESS_ONCE(ring->hdr->cq_head);
+
+	/* a bogus head written by userspace leaves no space */
+	if (used > ring->cq_entries)
+		return 0;
+
+	return ring->cq_entries - used;
+}
+
+static void kdbus_ring_complete(struct kdbus_ring *ring, u64 user_data,
+				s64 result, u64 offset)
+{
+	struct kdbus_ring_cqe *cqe;
+
+	cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+	cqe->user_data = user_data;
+	cqe->result = result;
+	cqe->offset = offset;
+	ring->cq_tail++;
+}
+
+/* carry out a single submission, at least one completion slot is free */
+static void kdbus_ring_submit(struct kdbus_ring *ring,
+			      struct kdbus_conn *conn,
+			      const struct kdbus_ring_sqe *sqe)
+{
+	int ret;
+
+	if (sqe->flags != 0) {
+		kdbus_ring_complete(ring, sqe->user_data, -ENOTSUPP, 0);
+		return;
+	}
+
+	switch (sqe->opcode) {
+	case KDBUS_RING_OP_NOP:
+		ret = 0;
+		break;
+
+	case KDBUS_RING_OP_MSG_SEND: {
+		struct kdbus_kmsg *kmsg;
+
+		if (!KDBUS_IS_ALIGNED8(sqe->arg)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = kdbus_kmsg_new_from_user(conn, KDBUS_PTR(sqe->arg),
+					       &kmsg);
+		if (ret < 0)
+			break;
+
+		ret = kdbus_conn_kmsg_send(conn->ep, conn, kmsg);
+		kdbus_kmsg_free(kmsg);
+		break;
+	}
+
+	case KDBUS_RING_OP_MSG_RECV: {
+		u64 count, i;
+
+		count = kdbus_ring_cq_space(ring);
+		if (sqe->arg > 0 && sqe->arg < count)
+			count = sqe->arg;
+
+		for (i = 0; i < count; i++) {
+			u64 off;
+
+			ret = kdbus_conn_recv_msg(conn, 0, &off);
+			if (ret < 0)
+				break;
+
+			kdbus_ring_complete(ring, sqe->user_data, 0, off);
+		}
+
+		/* an empty queue is only reported if nothing was received */
+		if (i > 0)
+			return;
+		break;
+	}
+
+	case KDBUS_RING_OP_FREE:
+		ret = kdbus_conn_free_range(conn, sqe->arg);
+		break;
+
+	default:
+		ret = -ENOTSUPP;
+		break;
+	}
+
+	kdbus_ring_complete(ring, sqe->user_data, ret, 0);
+}
+
+/*
+ * Once set up, the rings stay around until the connection is freed; the
+ * pointer is published after the rings are initialized, see
+ * kdbus_cmd_ring_setup().
+ */
+static struct kdbus_ring *kdbus_ring_get(struct kdbus_conn *conn)
+{
+	return READ_ONCE(conn->ring);
+}
+
+/**
+ * kdbus_cmd_ring_setup() - handle KDBUS_CMD_RING_SETUP
+ * @conn:		The connection to set up the rings for
+ * @buf:		The struct kdbus_cmd_ring passed in by the user
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_cmd_ring_setup(struct kdbus_conn *conn, void __user *buf)
+{
+	struct kdbus_cmd_ring cmd;
+	struct kdbus_ring *ring;
+	int ret;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.flags != 0)
+		return -ENOTSUPP;
+
+	/* starter connections do not receive anything themselves */
+	if (conn->flags & KDBUS_HELLO_STARTER)
+		return -EPERM;
+
+	if (cmd.sq_entries == 0 || cmd.sq_entries > KDBUS_RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	if (cmd.cq_entries == 0)
+		cmd.cq_entries = min_t(u64, cmd.sq_entries * 2,
+				       KDBUS_RING_MAX_ENTRIES);
+
+	if (cmd.cq_entries > KDBUS_RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	cmd.sq_entries = roundup_pow_of_two(cmd.sq_entries);
+	cmd.cq_entries = roundup_pow_of_two(cmd.cq_entries);
+
+	ret = kdbus_ring_new(cmd.sq_entries, cmd.cq_entries, &ring);
+	if (ret < 0)
+		return ret;
+
+	cmd.size = ring->size;
+	if (copy_to_user(buf, &cmd, sizeof(cmd))) {
+		ret = -EFAULT;
+		goto exit_free;
+	}
+
+	mutex_lock(&conn->lock);
+	if (conn->ring) {
+		mutex_unlock(&conn->lock);
+		ret = -EEXIST;
+		goto exit_free;
+	}
+
+	/* the lock only serializes the setup, readers do not take it */
+	smp_store_release(&conn->ring, ring);
+	mutex_unlock(&conn->lock);
+
+	return 0;
+
+exit_free:
+	kdbus_ring_free(ring);
+	return ret;
+}
+
+/**
+ * kdbus_cmd_ring_enter() - handle KDBUS_CMD_RING_ENTER
+ * @conn:		The connection owning the rings
+ * @buf:		The struct kdbus_cmd_ring_enter passed in by the user
+ *
+ * All entries posted to the submission ring are carried out in order,
+ * until the completion ring runs out of space. The results are posted
+ * to the completion ring; the ioctl itself only fails if the rings
+ * are not usable at all.
+ *
+ * Returns: 0 on success, negative errno on failure.
+ */
+int kdbus_cmd_ring_enter(struct kdbus_conn *conn, void __user *buf)
+{
+	struct kdbus_cmd_ring_enter cmd;
+	struct kdbus_ring *ring;
+	u64 tail;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.flags != 0)
+		return -ENOTSUPP;
+
+	ring = kdbus_ring_get(conn);
+	if (!ring)
+		return -ENXIO;
+
+	mutex_lock(&ring->lock);
+	tail = ACCESS_ONCE(ring->hdr->sq_tail);
+
+	/* read the entries only after the tail which announced them */
+	smp_rmb();
+
+	if (tail - ring->sq_head > ring->sq_entries) {
+		ret = -EINVAL;
+		goto exit_unlock;
+	}
+
+	cmd.submitted = 0;
+	while (ring->sq_head != tail) {
+		struct kdbus_ring_sqe sqe;
+
+		if (kdbus_ring_cq_space(ring) == 0)
+			break;
+
+		/* userspace may change the entry under us, work on a copy */
+		sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+		ring->sq_head++;
+		cmd.submitted++;
+
+		kdbus_ring_submit(ring, conn, &sqe);
+
+		/* publish the completion entries before the counters */
+		smp_wmb();
+		ring->hdr->cq_tail = ring->cq_tail;
+		ring->hdr->sq_head = ring->sq_head;
+	}
+
+	if (cmd.submitted == 0 && ring->sq_head != tail)
+		ret = -EBUSY;
+
+exit_unlock:
+	mutex_unlock(&ring->lock);
+	if (ret < 0)
+		return ret;
+
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+ * kdbus_ring_mmap() - map the rings into the process
+ * @conn:		The connection owning the rings
+ * @vma:		passed by mmap() syscall
+ *
+ * Unlike the pool, the mapping keeps referencing the connection's file,
+ * so the rings are not freed before the last mapping is gone.
+ *
+ * Returns: the result of the mmap() call, negative errno on failure.
+ */
+int kdbus_ring_mmap(struct kdbus_conn *conn, struct vm_area_struct *vma)
+{
+	struct kdbus_ring *ring;
+
+	ring = kdbus_ring_get(conn);
+	if (!ring)
+		return -ENXIO;
+
+	/* submissions are written by userspace, a private copy is useless */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	/* do not allow to map more than the size of the rings */
+	if ((vma->vm_end - vma->vm_start) > ring->size)
+		return -EFAULT;
+
+	return remap_vmalloc_range(vma, ring->mem, 0);
+}
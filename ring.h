@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2013 Kay Sievers
+ * Copyright (C) 2013 Greg Kroah-Hartman <gregkh@linuxfoundation.org>
+ * Copyright (C) 2013 Daniel Mack <daniel@zonque.org>
+ * Copyright (C) 2013 Linux Foundation
+ *
+ * kdbus is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#ifndef __KDBUS_RING_H
+#define __KDBUS_RING_H
+
+struct kdbus_conn;
+struct kdbus_ring;
+
+int kdbus_cmd_ring_setup(struct kdbus_conn *conn, void __user *buf);
+int kdbus_cmd_ring_enter(struct kdbus_conn *conn, void __user *buf);
+int kdbus_ring_mmap(struct kdbus_conn *conn, struct vm_area_struct *vma);
+void kdbus_ring_free(struct kdbus_ring *ring);
+#endif
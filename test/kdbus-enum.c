@@ -42,6 +42,7 @@ TABLE(CMD) = {
 	ENUM(KDBUS_CMD_HELLO),
 	ENUM(KDBUS_CMD_MSG_SEND),
 	ENUM(KDBUS_CMD_MSG_RECV),
+	ENUM(KDBUS_CMD_MSG_INSTALL_FDS),
 	ENUM(KDBUS_CMD_NAME_LIST),
 	ENUM(KDBUS_CMD_NAME_RELEASE),
 	ENUM(KDBUS_CMD_CONN_INFO),
@@ -49,6 +50,8 @@ TABLE(CMD) = {
 	ENUM(KDBUS_CMD_MATCH_REMOVE),
 	ENUM(KDBUS_CMD_MONITOR),
 	ENUM(KDBUS_CMD_EP_POLICY_SET),
+	ENUM(KDBUS_CMD_RING_SETUP),
+	ENUM(KDBUS_CMD_RING_ENTER),
 };
 LOOKUP(CMD);
 
@@ -27,7 +27,7 @@
 #include "kdbus-enum.h"
 
 #define POOL_SIZE (16 * 1024LU * 1024LU)
-struct conn *connect_to_bus(const char *path)
+struct conn *__connect_to_bus(const char *path, uint64_t memfd_inline_max)
 {
 	int fd, ret;
 	struct kdbus_cmd_hello __attribute__ ((__aligned__(8))) hello;
@@ -57,6 +57,7 @@ struct conn *connect_to_bus(const char *path)
 
 	hello.size = sizeof(struct kdbus_cmd_hello);
 	hello.pool_size = POOL_SIZE;
+	hello.memfd_inline_max = memfd_inline_max;
 
 	ret = ioctl(fd, KDBUS_CMD_HELLO, &hello);
 	if (ret < 0) {
@@ -88,6 +89,11 @@ struct conn *connect_to_bus(const char *path)
 	return conn;
 }
 
+struct conn *connect_to_bus(const char *path)
+{
+	return __connect_to_bus(path, 0);
+}
+
 int msg_send(const struct conn *conn,
 		    const char *name,
 		    uint64_t cookie,
@@ -385,20 +391,20 @@ void msg_dump(const struct conn *conn, const struct kdbus_msg *msg)
 
 int msg_recv(struct conn *conn)
 {
-	uint64_t off;
+	struct kdbus_cmd_recv recv = {};
 	struct kdbus_msg *msg;
 	int ret;
 
-	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &off);
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
 	if (ret < 0) {
 		fprintf(stderr, "error receiving message: %d (%m)\n", ret);
 		return EXIT_FAILURE;
 	}
 
-	msg = (struct kdbus_msg *)(conn->buf + off);
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
 	msg_dump(conn, msg);
 
-	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &off);
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
 	if (ret < 0) {
 		fprintf(stderr, "error free message: %d (%m)\n", ret);
 		return EXIT_FAILURE;
@@ -43,6 +43,7 @@ int msg_recv(struct conn *conn);
 void msg_dump(const struct conn *conn, const struct kdbus_msg *msg);
 char *msg_id(uint64_t id, char *buf);
 int msg_send(const struct conn *conn, const char *name, uint64_t cookie, uint64_t dst_id);
+struct conn *__connect_to_bus(const char *path, uint64_t memfd_inline_max);
 struct conn *connect_to_bus(const char *path);
 void append_policy(struct kdbus_cmd_policy *cmd_policy, struct kdbus_item *policy, __u64 max_size);
 struct kdbus_item *make_policy_name(const char *name);
@@ -10,6 +10,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <poll.h>
+#include <getopt.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -18,14 +19,32 @@
 #include "kdbus-enum.h"
 
 #define SERVICE_NAME "foo.bar.echo"
+#define POOL_SIZE (16 * 1024LU * 1024LU)
 
 static char stress_payload[8192];
 
+static bool use_ring;
+static bool use_busy_poll;
+static bool use_memfd_inline;
+static unsigned int n_senders = 1;
+static bool use_many_to_one;
+static bool use_connect;
+static unsigned int sender_index;
+
+struct ring {
+	struct kdbus_ring_header *hdr;
+	struct kdbus_ring_sqe *sqes;
+	struct kdbus_ring_cqe *cqes;
+	size_t size;
+};
+
 struct stats {
 	uint64_t count;
 	uint64_t latency_acc;
 	uint64_t latency_low;
 	uint64_t latency_high;
+	uint64_t send_count;
+	uint64_t send_acc;
 };
 
 static struct stats stats;
@@ -47,19 +66,30 @@ static void reset_stats(void)
 	stats.latency_acc = 0;
 	stats.latency_low = UINT64_MAX;
 	stats.latency_high = 0;
+	stats.send_count = 0;
+	stats.send_acc = 0;
 }
 
 static void dump_stats(void)
 {
+	/* tell the pairs apart when several of them share the bus */
+	if (n_senders > 1)
+		printf("[%u] ", sender_index);
+
 	if (stats.count > 0) {
 		printf("stats: %llu packets processed, latency (usecs) min/max/avg %llu/%llu/%llu\n",
 			(unsigned long long) stats.count,
 			(unsigned long long) stats.latency_low,
 			(unsigned long long) stats.latency_high,
 			(unsigned long long) (stats.latency_acc / stats.count));
-	} else {
+	} else if (stats.send_count == 0) {
 		printf("*** no packets received. bus stuck?\n");
 	}
+
+	/* the cost of creating, filling and sending the memfd */
+	if (stats.send_count > 0)
+		printf("stats: send (usecs) avg %llu\n",
+			(unsigned long long) (stats.send_acc / stats.send_count));
 }
 
 static void add_stats(const struct timeval *tv)
@@ -80,14 +110,79 @@ static void add_stats(const struct timeval *tv)
 }
 
 static int
-send_echo_request(struct conn *conn, uint64_t dst_id)
+ring_setup(struct conn *conn, struct ring *ring)
+{
+	struct kdbus_cmd_ring cmd = {};
+	void *p;
+	int ret;
+
+	cmd.sq_entries = 64;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_RING_SETUP, &cmd);
+	if (ret < 0) {
+		fprintf(stderr, "KDBUS_CMD_RING_SETUP failed: %m\n");
+		return EXIT_FAILURE;
+	}
+
+	p = mmap(NULL, cmd.size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		 conn->fd, KDBUS_MMAP_OFF_RING);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "mapping the rings failed: %m\n");
+		return EXIT_FAILURE;
+	}
+
+	ring->hdr = p;
+	ring->sqes = (struct kdbus_ring_sqe *)((uint8_t *)p + ring->hdr->sq_offset);
+	ring->cqes = (struct kdbus_ring_cqe *)((uint8_t *)p + ring->hdr->cq_offset);
+	ring->size = cmd.size;
+
+	return 0;
+}
+
+static void
+ring_post(struct ring *ring, uint64_t opcode, uint64_t user_data, uint64_t arg)
+{
+	struct kdbus_ring_sqe *sqe;
+
+	sqe = &ring->sqes[ring->hdr->sq_tail & (ring->hdr->sq_entries - 1)];
+	sqe->opcode = opcode;
+	sqe->flags = 0;
+	sqe->user_data = user_data;
+	sqe->arg = arg;
+
+	__sync_synchronize();
+	ring->hdr->sq_tail++;
+}
+
+static int
+ring_enter(struct conn *conn)
+{
+	struct kdbus_cmd_ring_enter cmd = {};
+	int ret;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_RING_ENTER, &cmd);
+	if (ret < 0) {
+		fprintf(stderr, "KDBUS_CMD_RING_ENTER failed: %m\n");
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns -EAGAIN if the receiver cannot take the message right now,
+ * which only the senders of --many-to-one expect.
+ */
+static int
+send_echo_request(struct conn *conn, struct ring *ring, uint64_t dst_id,
+		  const char *name)
 {
 	struct kdbus_msg *msg;
 	struct kdbus_item *item;
 	uint64_t size;
 	int memfd = -1;
 	int ret;
-	struct timeval now;
+	struct timeval now, end;
 
 	gettimeofday(&now, NULL);
 
@@ -113,6 +208,9 @@ send_echo_request(struct conn *conn, uint64_t dst_id)
 
 	size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd));
 
+	if (name)
+		size += KDBUS_ITEM_SIZE(strlen(name) + 1);
+
 	msg = malloc(size);
 	if (!msg) {
 		fprintf(stderr, "unable to malloc()!?\n");
@@ -122,11 +220,18 @@ send_echo_request(struct conn *conn, uint64_t dst_id)
 	memset(msg, 0, size);
 	msg->size = size;
 	msg->src_id = conn->id;
-	msg->dst_id = dst_id;
+	msg->dst_id = name ? KDBUS_DST_ID_NAME : dst_id;
 	msg->payload_type = KDBUS_PAYLOAD_DBUS;
 
 	item = msg->items;
 
+	if (name) {
+		item->type = KDBUS_ITEM_DST_NAME;
+		item->size = KDBUS_ITEM_HEADER_SIZE + strlen(name) + 1;
+		strcpy(item->str, name);
+		item = KDBUS_ITEM_NEXT(item);
+	}
+
 	item->type = KDBUS_ITEM_PAYLOAD_VEC;
 	item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_vec);
 	item->vec.address = (uint64_t) stress_payload;
@@ -139,7 +244,30 @@ send_echo_request(struct conn *conn, uint64_t dst_id)
 	item->memfd.fd = memfd;
 	item = KDBUS_ITEM_NEXT(item);
 
-	ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, msg);
+	if (ring) {
+		struct kdbus_ring_cqe *cqe;
+
+		ring_post(ring, KDBUS_RING_OP_MSG_SEND, 0, (uint64_t) msg);
+		ret = ring_enter(conn);
+		if (ret)
+			return ret;
+
+		cqe = &ring->cqes[ring->hdr->cq_head & (ring->hdr->cq_entries - 1)];
+		ret = cqe->result;
+		ring->hdr->cq_head++;
+	} else {
+		ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, msg);
+		if (ret < 0)
+			ret = -errno;
+	}
+
+	/* the receiver is full, or has not acquired its name yet */
+	if (ret == -ENOBUFS || ret == -EXFULL || ret == -ESRCH) {
+		close(memfd);
+		free(msg);
+		return -EAGAIN;
+	}
+
 	if (ret) {
 		fprintf(stderr, "error sending message: %d err %d (%m)\n", ret, errno);
 		return EXIT_FAILURE;
@@ -149,23 +277,19 @@ send_echo_request(struct conn *conn, uint64_t dst_id)
 		close(memfd);
 	free(msg);
 
+	gettimeofday(&end, NULL);
+	stats.send_count++;
+	stats.send_acc += timeval_diff(&end, &now);
+
 	return 0;
 }
 
-static int
-handle_echo_reply(struct conn *conn)
+static void
+handle_echo_msg(struct conn *conn, uint64_t off)
 {
-	int ret;
-	uint64_t off;
 	struct kdbus_msg *msg;
 	const struct kdbus_item *item;
 
-	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &off);
-	if (ret < 0) {
-		fprintf(stderr, "error receiving message: %d (%m)\n", ret);
-		return EXIT_FAILURE;
-	}
-
 	msg = (struct kdbus_msg *)(conn->buf + off);
 	item = msg->items;
 
@@ -187,13 +311,40 @@ handle_echo_reply(struct conn *conn)
 		}
 
 		case KDBUS_ITEM_PAYLOAD_OFF: {
-			/* ignore */
+			/* the timestamp memfd, copied into the pool */
+			if (use_memfd_inline &&
+			    item->vec.size == sizeof(struct timeval))
+				add_stats((struct timeval *)
+					  ((char *)conn->buf + item->vec.offset));
 			break;
 		}
 		}
 	}
+}
+
+static int
+handle_echo_reply(struct conn *conn)
+{
+	struct kdbus_cmd_recv recv = {};
+	int ret;
+
+	if (use_busy_poll) {
+		recv.flags = KDBUS_RECV_BUSY_POLL;
+		recv.busy_poll_us = 50;
+	}
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	if (ret < 0 && use_busy_poll && errno == EAGAIN)
+		return -EAGAIN;
 
-	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &off);
+	if (ret < 0) {
+		fprintf(stderr, "error receiving message: %d (%m)\n", ret);
+		return EXIT_FAILURE;
+	}
+
+	handle_echo_msg(conn, recv.offset);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
 	if (ret < 0) {
 		fprintf(stderr, "error free message: %d (%m)\n", ret);
 		return EXIT_FAILURE;
@@ -202,6 +353,157 @@ handle_echo_reply(struct conn *conn)
 	return 0;
 }
 
+/*
+ * Receive all queued messages with a single KDBUS_CMD_RING_ENTER, which
+ * also releases the messages handled in the previous round.
+ */
+static int
+handle_echo_reply_ring(struct conn *conn, struct ring *ring)
+{
+	static uint64_t offsets[64];
+	static unsigned int n_offsets;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n_offsets; i++)
+		ring_post(ring, KDBUS_RING_OP_FREE, 0, offsets[i]);
+	n_offsets = 0;
+
+	ring_post(ring, KDBUS_RING_OP_MSG_RECV, 1, ELEMENTSOF(offsets));
+
+	ret = ring_enter(conn);
+	if (ret)
+		return ret;
+
+	while (ring->hdr->cq_head != ring->hdr->cq_tail) {
+		struct kdbus_ring_cqe *cqe;
+
+		cqe = &ring->cqes[ring->hdr->cq_head & (ring->hdr->cq_entries - 1)];
+		if (cqe->result < 0 && cqe->result != -EAGAIN) {
+			fprintf(stderr, "ring operation failed: %lld\n",
+				(long long) cqe->result);
+			return EXIT_FAILURE;
+		}
+
+		/* only completed receives carry a message */
+		if (cqe->user_data == 1 && cqe->result == 0) {
+			handle_echo_msg(conn, cqe->offset);
+			offsets[n_offsets++] = cqe->offset;
+		}
+
+		ring->hdr->cq_head++;
+	}
+
+	return 0;
+}
+
+static int run_sender(const char *bus)
+{
+	struct conn *conn;
+	struct timeval start, now;
+	int ret;
+
+	conn = connect_to_bus(bus);
+	if (!conn)
+		return EXIT_FAILURE;
+
+	gettimeofday(&start, NULL);
+	reset_stats();
+
+	for (;;) {
+		ret = send_echo_request(conn, NULL, 0, SERVICE_NAME);
+		if (ret == -EAGAIN)
+			usleep(10);
+		else if (ret)
+			break;
+
+		gettimeofday(&now, NULL);
+		if (timeval_diff(&now, &start) / 1000ULL > 1000ULL) {
+			start = now;
+			dump_stats();
+			reset_stats();
+		}
+	}
+
+	close(conn->fd);
+	free(conn);
+
+	return EXIT_FAILURE;
+}
+
+/*
+ * Measure how many connections per second can be set up and torn down;
+ * the connections neither map their pool nor exchange any message.
+ */
+static int run_connect(const char *bus)
+{
+	struct kdbus_cmd_hello __attribute__ ((__aligned__(8))) hello;
+	struct timeval start, now, tv;
+	uint64_t cycles = 0;
+	int fd, ret;
+
+	gettimeofday(&start, NULL);
+	reset_stats();
+
+	for (;;) {
+		gettimeofday(&tv, NULL);
+
+		fd = open(bus, O_RDWR|O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "--- error %d (%m)\n", fd);
+			return EXIT_FAILURE;
+		}
+
+		memset(&hello, 0, sizeof(hello));
+		hello.size = sizeof(struct kdbus_cmd_hello);
+		hello.conn_flags = KDBUS_HELLO_ACCEPT_FD;
+		hello.pool_size = POOL_SIZE;
+
+		ret = ioctl(fd, KDBUS_CMD_HELLO, &hello);
+		if (ret < 0) {
+			fprintf(stderr, "--- error when saying hello: %d (%m)\n", ret);
+			close(fd);
+			return EXIT_FAILURE;
+		}
+
+		close(fd);
+		add_stats(&tv);
+		cycles++;
+
+		gettimeofday(&now, NULL);
+		if (timeval_diff(&now, &start) / 1000ULL > 1000ULL) {
+			if (n_senders > 1)
+				printf("[%u] ", sender_index);
+
+			printf("stats: %llu connections/s, HELLO+close (usecs) min/max/avg %llu/%llu/%llu\n",
+				(unsigned long long) (cycles * 1000000ULL /
+						      timeval_diff(&now, &start)),
+				(unsigned long long) stats.latency_low,
+				(unsigned long long) stats.latency_high,
+				(unsigned long long) (stats.latency_acc / stats.count));
+
+			start = now;
+			cycles = 0;
+			reset_stats();
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [OPTIONS]\n"
+	       "  -h, --help        Show this help\n"
+	       "  -r, --ring        Exchange messages through the submission/completion rings\n"
+	       "  -b, --busy-poll   Spin in the kernel for replies instead of calling poll()\n"
+	       "  -i, --inline      Receive the timestamp memfd copied into the pool\n"
+	       "  -s, --senders=N   Run N sender/receiver pairs on the bus concurrently\n"
+	       "  -m, --many-to-one With --senders, let all senders send to the first receiver\n"
+	       "  -c, --connect     Measure HELLO/close cycles instead of exchanging messages\n",
+	       argv0);
+}
+
 int main(int argc, char *argv[])
 {
 	struct {
@@ -218,7 +520,71 @@ int main(int argc, char *argv[])
 	struct conn *conn_b;
 	struct pollfd fds[2];
 	struct timeval start;
+	struct ring ring_a;
+	struct ring ring_b;
 	unsigned int i;
+	int c;
+
+	static const struct option options[] = {
+		{ "help",	no_argument,	NULL, 'h' },
+		{ "ring",	no_argument,	NULL, 'r' },
+		{ "busy-poll",	no_argument,	NULL, 'b' },
+		{ "inline",	no_argument,	NULL, 'i' },
+		{ "senders",	required_argument, NULL, 's' },
+		{ "many-to-one", no_argument,	NULL, 'm' },
+		{ "connect",	no_argument,	NULL, 'c' },
+		{}
+	};
+
+	while ((c = getopt_long(argc, argv, "hrbis:mc", options, NULL)) >= 0) {
+		switch (c) {
+		case 'r':
+			use_ring = true;
+			break;
+
+		case 'b':
+			use_busy_poll = true;
+			break;
+
+		case 'i':
+			use_memfd_inline = true;
+			break;
+
+		case 's':
+			n_senders = strtoul(optarg, NULL, 10);
+			if (n_senders < 1) {
+				fprintf(stderr, "invalid number of senders\n");
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'm':
+			use_many_to_one = true;
+			break;
+
+		case 'c':
+			use_connect = true;
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (use_ring && use_busy_poll) {
+		fprintf(stderr, "--ring and --busy-poll are mutually exclusive\n");
+		return EXIT_FAILURE;
+	}
+
+	if (use_many_to_one && use_ring) {
+		fprintf(stderr, "--many-to-one and --ring are mutually exclusive\n");
+		return EXIT_FAILURE;
+	}
 
 	for (i = 0; i < sizeof(stress_payload); i++)
 		stress_payload[i] = i;
@@ -250,7 +616,42 @@ int main(int argc, char *argv[])
 	if (asprintf(&bus, "/dev/kdbus/%s/bus", bus_make.name) < 0)
 		return EXIT_FAILURE;
 
-	conn_a = connect_to_bus(bus);
+	/*
+	 * Every additional pair of connections runs in its own process,
+	 * sending to its own receiver. The pairs only share the bus, so
+	 * their numbers show how much they slow each other down.
+	 */
+	for (i = 1; i < n_senders; i++) {
+		pid_t pid;
+
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "--- fork failed: %m\n");
+			return EXIT_FAILURE;
+		}
+
+		if (pid == 0) {
+			sender_index = i;
+			break;
+		}
+	}
+
+	if (n_senders > 1 && sender_index == 0)
+		printf("-- running %u sender/receiver pairs%s\n", n_senders,
+		       use_many_to_one ? ", all sending to the first receiver" : "");
+
+	/* with --senders, every process sets up connections concurrently */
+	if (use_connect)
+		return run_connect(bus);
+
+	/*
+	 * The additional senders of --many-to-one do not wait for anything,
+	 * they keep the queue of the first receiver filled.
+	 */
+	if (use_many_to_one && sender_index > 0)
+		return run_sender(bus);
+
+	conn_a = __connect_to_bus(bus, use_memfd_inline ? 4096 : 0);
 	if (!conn_a)
 		return EXIT_FAILURE;
 
@@ -258,7 +659,9 @@ int main(int argc, char *argv[])
 	if (!conn_b)
 		return EXIT_FAILURE;
 
-	upload_policy(conn_a->fd, SERVICE_NAME);
+	/* the well-known name can only be owned by the first pair */
+	if (sender_index == 0)
+		upload_policy(conn_a->fd, SERVICE_NAME);
 
 	add_match_empty(conn_a->fd);
 	add_match_empty(conn_b->fd);
@@ -266,12 +669,21 @@ int main(int argc, char *argv[])
 	fds[0].fd = conn_a->fd;
 	fds[1].fd = conn_b->fd;
 
-	name_acquire(conn_a, SERVICE_NAME, 0);
+	if (sender_index == 0)
+		name_acquire(conn_a, SERVICE_NAME, 0);
+
+	if (use_ring) {
+		printf("-- using submission/completion rings\n");
+
+		if (ring_setup(conn_a, &ring_a) || ring_setup(conn_b, &ring_b))
+			return EXIT_FAILURE;
+	}
 
 	gettimeofday(&start, NULL);
 	reset_stats();
 
-	ret = send_echo_request(conn_b, conn_a->id);
+	ret = send_echo_request(conn_b, use_ring ? &ring_b : NULL, conn_a->id,
+				NULL);
 	if (ret)
 		return EXIT_FAILURE;
 
@@ -287,16 +699,29 @@ int main(int argc, char *argv[])
 			fds[i].revents = 0;
 		}
 
-		ret = poll(fds, nfds, 10);
-		if (ret < 0)
-			break;
+		if (use_busy_poll) {
+			/* the receive ioctl waits for the reply itself */
+			fds[0].revents = POLLIN;
+		} else {
+			ret = poll(fds, nfds, 10);
+			if (ret < 0)
+				break;
+		}
 
 		if (fds[0].revents & POLLIN) {
-			ret = handle_echo_reply(conn_a);
+			if (use_ring)
+				ret = handle_echo_reply_ring(conn_a, &ring_a);
+			else
+				ret = handle_echo_reply(conn_a);
+			if (ret == -EAGAIN)
+				continue;
 			if (ret)
 				break;
 
-			ret = send_echo_request(conn_b, conn_a->id);
+			ret = send_echo_request(conn_b, use_ring ? &ring_b : NULL,
+						conn_a->id, NULL);
+			if (ret == -EAGAIN)
+				continue;
 			if (ret)
 				break;
 		}
@@ -312,6 +737,11 @@ int main(int argc, char *argv[])
 
 	printf("-- closing bus connections\n");
 
+	if (use_ring) {
+		munmap(ring_a.hdr, ring_a.size);
+		munmap(ring_b.hdr, ring_b.size);
+	}
+
 	close(conn_a->fd);
 	close(conn_b->fd);
 
@@ -26,6 +26,7 @@ enum {
 enum {
 	CHECK_CREATE_BUS	= 1 << 0,
 	CHECK_CREATE_CONN	= 1 << 1,
+	CHECK_NAME_DIRECTORY	= 1 << 2,
 };
 
 struct kdbus_conn {
@@ -66,7 +67,10 @@ struct kdbus_check {
 		return CHECK_ERR;	\
 	}
 
-static struct kdbus_conn *make_conn(const char *buspath)
+static struct kdbus_conn *__make_conn(const char *buspath,
+				      uint64_t memfd_inline_max,
+				      uint64_t vec_memfd_min,
+				      uint64_t conn_flags)
 {
 	int ret;
 	struct kdbus_conn *conn;
@@ -85,7 +89,7 @@ static struct kdbus_conn *make_conn(const char *buspath)
 		return NULL;
 	}
 
-	conn->hello.conn_flags = KDBUS_HELLO_ACCEPT_FD;
+	conn->hello.conn_flags = KDBUS_HELLO_ACCEPT_FD | conn_flags;
 
 	conn->hello.attach_flags = KDBUS_ATTACH_TIMESTAMP |
 				   KDBUS_ATTACH_CREDS |
@@ -100,6 +104,8 @@ static struct kdbus_conn *make_conn(const char *buspath)
 
 	conn->hello.size = sizeof(struct kdbus_cmd_hello);
 	conn->hello.pool_size = POOL_SIZE;
+	conn->hello.memfd_inline_max = memfd_inline_max;
+	conn->hello.vec_memfd_min = vec_memfd_min;
 
 	ret = ioctl(conn->fd, KDBUS_CMD_HELLO, &conn->hello);
 	if (ret < 0) {
@@ -107,6 +113,10 @@ static struct kdbus_conn *make_conn(const char *buspath)
 		return NULL;
 	}
 
+	/* there is no pool to map */
+	if (conn_flags & KDBUS_HELLO_SEND_ONLY)
+		return conn;
+
 	conn->buf = mmap(NULL, POOL_SIZE, PROT_READ, MAP_SHARED, conn->fd, 0);
 	if (conn->buf == MAP_FAILED) {
 		free(conn);
@@ -117,6 +127,11 @@ static struct kdbus_conn *make_conn(const char *buspath)
 	return conn;
 }
 
+static struct kdbus_conn *make_conn(const char *buspath)
+{
+	return __make_conn(buspath, 0, 0, 0);
+}
+
 static void free_conn(struct kdbus_conn *conn)
 {
 	if (conn->buf)
@@ -178,17 +193,16 @@ static int send_message(const struct kdbus_conn *conn,
 
 	if (dst_id == KDBUS_DST_ID_BROADCAST)
 		size += KDBUS_ITEM_HEADER_SIZE + 64;
-	else {
-		ret = ioctl(conn->fd, KDBUS_CMD_MEMFD_NEW, &memfd);
-		ASSERT_RETURN(ret == 0);
 
-		ASSERT_RETURN(write(memfd, "kdbus memfd 1234567", 19) == 19);
+	ret = ioctl(conn->fd, KDBUS_CMD_MEMFD_NEW, &memfd);
+	ASSERT_RETURN(ret == 0);
 
-		ret = ioctl(memfd, KDBUS_CMD_MEMFD_SEAL_SET, 1);
-		ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(write(memfd, "kdbus memfd 1234567", 19) == 19);
 
-		size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd));
-	}
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SEAL_SET, 1);
+	ASSERT_RETURN(ret == 0);
+
+	size += KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd));
 
 	if (name)
 		size += KDBUS_ITEM_SIZE(strlen(name) + 1);
@@ -231,16 +245,17 @@ static int send_message(const struct kdbus_conn *conn,
 	item->vec.size = sizeof(ref2);
 	item = KDBUS_ITEM_NEXT(item);
 
+	item->type = KDBUS_ITEM_PAYLOAD_MEMFD;
+	item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_memfd);
+	item->memfd.size = 19;
+	item->memfd.fd = memfd;
+	item = KDBUS_ITEM_NEXT(item);
+
 	if (dst_id == KDBUS_DST_ID_BROADCAST) {
 		item->type = KDBUS_ITEM_BLOOM;
 		item->size = KDBUS_ITEM_HEADER_SIZE + 64;
-	} else {
-		item->type = KDBUS_ITEM_PAYLOAD_MEMFD;
-		item->size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_memfd);
-		item->memfd.size = 16;
-		item->memfd.fd = memfd;
+		item = KDBUS_ITEM_NEXT(item);
 	}
-	item = KDBUS_ITEM_NEXT(item);
 
 	ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, msg);
 	ASSERT_RETURN(ret == 0);
@@ -451,6 +466,97 @@ static int check_name_basic(struct kdbus_check_env *env)
 	return CHECK_OK;
 }
 
+/* look up the owner of a name in the name directory, 0 if not found */
+static uint64_t name_dir_lookup(const struct kdbus_name_dir *dir,
+				const char *name)
+{
+	uint64_t seq, id;
+	unsigned int i;
+
+	do {
+		while ((seq = *(volatile uint64_t *)&dir->seq) & 1)
+			;
+		__sync_synchronize();
+
+		id = 0;
+		for (i = 0; i < dir->entries_used; i++) {
+			if (dir->entries[i].id == 0)
+				continue;
+
+			if (strcmp(dir->entries[i].name, name) == 0) {
+				id = dir->entries[i].id;
+				break;
+			}
+		}
+
+		__sync_synchronize();
+	} while (*(volatile uint64_t *)&dir->seq != seq);
+
+	return id;
+}
+
+static int check_name_directory(struct kdbus_check_env *env)
+{
+	const struct kdbus_name_dir *dir;
+	struct kdbus_cmd_name *cmd_name;
+	struct kdbus_conn *conn;
+	uint64_t size;
+	char *name;
+	int ret;
+
+	dir = mmap(NULL, sizeof(*dir), PROT_READ, MAP_SHARED,
+		   env->conn->fd, KDBUS_MMAP_OFF_NAMES);
+	ASSERT_RETURN(dir != MAP_FAILED);
+	ASSERT_RETURN(dir->entries_max > 0);
+
+	size = sizeof(*dir) + dir->entries_max * sizeof(dir->entries[0]);
+	munmap((void *)dir, sizeof(*dir));
+
+	dir = mmap(NULL, size, PROT_READ, MAP_SHARED,
+		   env->conn->fd, KDBUS_MMAP_OFF_NAMES);
+	ASSERT_RETURN(dir != MAP_FAILED);
+
+	name = "foo.bla.dir";
+	ret = upload_policy(env->conn->fd, name);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(name_dir_lookup(dir, name) == 0);
+
+	conn = make_conn(env->buspath);
+	ASSERT_RETURN(conn != NULL);
+
+	ret = upload_policy(conn->fd, name);
+	ASSERT_RETURN(ret == 0);
+
+	size = sizeof(*cmd_name) + strlen(name) + 1;
+	cmd_name = alloca(size);
+
+	memset(cmd_name, 0, size);
+	strcpy(cmd_name->name, name);
+	cmd_name->size = size;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_NAME_ACQUIRE, cmd_name);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(name_dir_lookup(dir, name) == env->conn->hello.id);
+
+	/* queued waiters show up once they own the name */
+	cmd_name->flags = KDBUS_NAME_QUEUE;
+	ret = ioctl(conn->fd, KDBUS_CMD_NAME_ACQUIRE, cmd_name);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(name_dir_lookup(dir, name) == env->conn->hello.id);
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_NAME_RELEASE, cmd_name);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(name_dir_lookup(dir, name) == conn->hello.id);
+
+	free_conn(conn);
+	ASSERT_RETURN(name_dir_lookup(dir, name) == 0);
+	ASSERT_RETURN(!(dir->flags & KDBUS_NAME_DIR_INCOMPLETE));
+
+	munmap((void *)dir, size);
+
+	return CHECK_OK;
+}
+
 static int check_name_conflict(struct kdbus_check_env *env)
 {
 	struct kdbus_cmd_name *cmd_name;
@@ -561,7 +667,7 @@ static int check_msg_basic(struct kdbus_check_env *env)
 	struct kdbus_msg *msg;
 	uint64_t cookie = 0x1234abcd5678eeff;
 	struct pollfd fd;
-	uint64_t off;
+	struct kdbus_cmd_recv recv = {};
 	int ret;
 
 	/* create a 2nd connection */
@@ -583,20 +689,961 @@ static int check_msg_basic(struct kdbus_check_env *env)
 	ret = poll(&fd, 1, 100);
 	ASSERT_RETURN(ret > 0 && (fd.revents & POLLIN));
 
-	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &off);
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
 	ASSERT_RETURN(ret == 0);
 
-	msg = (struct kdbus_msg *)(conn->buf + off);
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
 	ASSERT_RETURN(msg->cookie == cookie);
 
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+static int check_msg_busy_poll(struct kdbus_check_env *env)
+{
+	struct kdbus_conn *conn;
+	struct kdbus_conn_status *status;
+	struct kdbus_cmd_recv recv = {};
+	uint64_t pool_free;
+	int ret;
+
+	conn = make_conn(env->buspath);
+	ASSERT_RETURN(conn != NULL);
+
+	status = mmap(NULL, sizeof(*status), PROT_READ, MAP_SHARED,
+		      conn->fd, KDBUS_MMAP_OFF_STATUS);
+	ASSERT_RETURN(status != MAP_FAILED);
+	ASSERT_RETURN(status->msg_count == 0);
+	ASSERT_RETURN(status->msg_bytes == 0);
+	ASSERT_RETURN(status->pool_free == POOL_SIZE);
+	ASSERT_RETURN((status->seq & 1) == 0);
+	pool_free = status->pool_free;
+
+	/* the status page must not be writable */
+	ASSERT_RETURN(mmap(NULL, sizeof(*status), PROT_READ | PROT_WRITE,
+			   MAP_SHARED, conn->fd,
+			   KDBUS_MMAP_OFF_STATUS) == MAP_FAILED);
+
+	/* spinning on an empty queue gives up after the timeout */
+	recv.flags = KDBUS_RECV_BUSY_POLL;
+	recv.busy_poll_us = 100;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == -1 && errno == EAGAIN);
+
+	/* the time to spin is limited */
+	recv.busy_poll_us = 1000 * 1000;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == -1 && errno == EINVAL);
+
+	ret = send_message(env->conn, NULL, 0xc0000000, conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(status->msg_count == 1);
+	ASSERT_RETURN(status->msg_bytes > 0);
+	ASSERT_RETURN(status->pool_free == pool_free - status->msg_bytes);
+
+	recv.busy_poll_us = 100;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(status->msg_count == 0);
+	ASSERT_RETURN(status->msg_bytes == 0);
+	ASSERT_RETURN(status->pool_free < pool_free);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(status->pool_free == pool_free);
+
+	munmap(status, sizeof(*status));
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+/* the fd number of the first PAYLOAD_MEMFD item of a message */
+static int msg_memfd(const struct kdbus_msg *msg)
+{
+	const struct kdbus_item *item;
+
+	KDBUS_ITEM_FOREACH(item, msg, items)
+		if (item->type == KDBUS_ITEM_PAYLOAD_MEMFD)
+			return item->memfd.fd;
+
+	return -2;
+}
+
+static int check_msg_broadcast_memfd(struct kdbus_check_env *env)
+{
+	struct kdbus_conn *conn[2];
+	struct kdbus_msg *msg;
+	struct kdbus_cmd_recv recv = {};
+	char buf[19];
+	unsigned int i;
+	int fd;
+	int ret;
+
+	for (i = 0; i < ELEMENTSOF(conn); i++) {
+		conn[i] = make_conn(env->buspath);
+		ASSERT_RETURN(conn[i] != NULL);
+		add_match_empty(conn[i]->fd);
+	}
+
+	/* broadcasts can carry a sealed memfd */
+	ret = send_message(env->conn, NULL, 0xc0000005, KDBUS_DST_ID_BROADCAST);
+	ASSERT_RETURN(ret == 0);
+
+	/* every receiver gets its own fd for the same file */
+	for (i = 0; i < ELEMENTSOF(conn); i++) {
+		ret = ioctl(conn[i]->fd, KDBUS_CMD_MSG_RECV, &recv);
+		ASSERT_RETURN(ret == 0);
+
+		msg = (struct kdbus_msg *)(conn[i]->buf + recv.offset);
+		ASSERT_RETURN(msg->cookie == 0xc0000005);
+
+		fd = msg_memfd(msg);
+		ASSERT_RETURN(fd >= 0);
+		ASSERT_RETURN(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+		ASSERT_RETURN(memcmp(buf, "kdbus memfd 1234567", 19) == 0);
+
+		/* the content is still queued for the other receivers */
+		ret = ioctl(fd, KDBUS_CMD_MEMFD_SEAL_SET, 0);
+		ASSERT_RETURN(ret < 0 && errno == EPERM);
+		close(fd);
+
+		ret = ioctl(conn[i]->fd, KDBUS_CMD_FREE, &recv.offset);
+		ASSERT_RETURN(ret == 0);
+
+		free_conn(conn[i]);
+	}
+
+	return CHECK_OK;
+}
+
+static int check_msg_lazy_fds(struct kdbus_check_env *env)
+{
+	struct kdbus_conn *conn;
+	struct kdbus_msg *msg;
+	struct kdbus_cmd_recv recv = {};
+	uint64_t off;
+	int fd;
+	int ret;
+
+	conn = make_conn(env->buspath);
+	ASSERT_RETURN(conn != NULL);
+
+	/* unicast messages carry a memfd */
+	ret = send_message(env->conn, NULL, 0xc0000001, conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+	ret = send_message(env->conn, NULL, 0xc0000002, conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+
+	recv.flags = KDBUS_RECV_LAZY_FDS;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+	ASSERT_RETURN(msg_memfd(msg) == -1);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_INSTALL_FDS, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	fd = msg_memfd(msg);
+	ASSERT_RETURN(fd >= 0);
+	close(fd);
+
+	/* the files can only be installed once */
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_INSTALL_FDS, &recv.offset);
+	ASSERT_RETURN(ret == -1 && errno == ENXIO);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	/* freeing the message drops the files which were never installed */
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+	ASSERT_RETURN(msg_memfd(msg) == -1);
+
+	off = recv.offset;
 	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &off);
 	ASSERT_RETURN(ret == 0);
 
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_INSTALL_FDS, &off);
+	ASSERT_RETURN(ret == -1 && errno == ENXIO);
+
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+static int check_msg_memfd_inline(struct kdbus_check_env *env)
+{
+	const struct kdbus_item *item;
+	struct kdbus_conn *conn;
+	struct kdbus_msg *msg;
+	struct kdbus_cmd_recv recv = {};
+	int found = 0;
+	int ret;
+
+	/* the limit for inlined memfds is enforced */
+	conn = __make_conn(env->buspath, 1024 * 1024, 0, 0);
+	ASSERT_RETURN(conn == NULL);
+
+	conn = __make_conn(env->buspath, 4096, 0, 0);
+	ASSERT_RETURN(conn != NULL);
+
+	/* unicast messages carry a small memfd */
+	ret = send_message(env->conn, NULL, 0xc0000003, conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+	ASSERT_RETURN(msg_memfd(msg) == -2);
+
+	KDBUS_ITEM_FOREACH(item, msg, items) {
+		if (item->type != KDBUS_ITEM_PAYLOAD_OFF ||
+		    item->vec.size != 19)
+			continue;
+
+		ASSERT_RETURN(memcmp((char *)conn->buf + item->vec.offset,
+				     "kdbus memfd 1234567", 19) == 0);
+		found = 1;
+	}
+	ASSERT_RETURN(found);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
 	free_conn(conn);
 
 	return CHECK_OK;
 }
 
+static int check_msg_vec_memfd(struct kdbus_check_env *env)
+{
+	const struct kdbus_item *item;
+	struct kdbus_conn *conn;
+	struct kdbus_msg *msg;
+	struct kdbus_cmd_recv recv = {};
+	char buf[12];
+	int found_memfd = 0, found_vec = 0;
+	int sealed;
+	int ret;
+
+	/* the threshold for vecs passed in a memfd is enforced */
+	conn = __make_conn(env->buspath, 0, 4096, 0);
+	ASSERT_RETURN(conn == NULL);
+
+	conn = __make_conn(env->buspath, 0, 64 * 1024, 0);
+	ASSERT_RETURN(conn != NULL);
+
+	/* the first vec is large, the second one is small */
+	ret = send_message(env->conn, NULL, 0xc0000004, conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	msg = (struct kdbus_msg *)(conn->buf + recv.offset);
+
+	KDBUS_ITEM_FOREACH(item, msg, items) {
+		switch (item->type) {
+		case KDBUS_ITEM_PAYLOAD_MEMFD:
+			if (item->memfd.size != 1024 * 1024 + 3) {
+				close(item->memfd.fd);
+				break;
+			}
+
+			ret = ioctl(item->memfd.fd, KDBUS_CMD_MEMFD_SEAL_GET,
+				    &sealed);
+			ASSERT_RETURN(ret == 0 && sealed);
+
+			ASSERT_RETURN(read(item->memfd.fd, buf, 12) == 12);
+			ASSERT_RETURN(memcmp(buf, "0123456789_0", 12) == 0);
+
+			close(item->memfd.fd);
+			found_memfd = 1;
+			break;
+
+		case KDBUS_ITEM_PAYLOAD_OFF:
+			ASSERT_RETURN(item->vec.size < 64 * 1024);
+			if (item->vec.size != 13)
+				break;
+
+			ASSERT_RETURN(memcmp((char *)conn->buf + item->vec.offset,
+					     "0123456789_1", 13) == 0);
+			found_vec = 1;
+			break;
+		}
+	}
+	ASSERT_RETURN(found_memfd && found_vec);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+static int check_memfd_splice(struct kdbus_check_env *env)
+{
+	char buf[16];
+	loff_t pos = 0;
+	int pipefd[2];
+	int memfd;
+	int ret;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MEMFD_NEW, &memfd);
+	ASSERT_RETURN(ret == 0);
+
+	ASSERT_RETURN(pipe(pipefd) == 0);
+
+	/* fill the memfd from a pipe */
+	ASSERT_RETURN(write(pipefd[1], "kdbus splice", 12) == 12);
+	ret = splice(pipefd[0], NULL, memfd, &pos, 12, 0);
+	ASSERT_RETURN(ret == 12);
+
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SEAL_SET, 1);
+	ASSERT_RETURN(ret == 0);
+
+	/* a sealed memfd can not be spliced into */
+	ASSERT_RETURN(write(pipefd[1], "x", 1) == 1);
+	pos = 0;
+	ret = splice(pipefd[0], NULL, memfd, &pos, 1, 0);
+	ASSERT_RETURN(ret == -1 && errno == EPERM);
+	ASSERT_RETURN(read(pipefd[0], buf, 1) == 1);
+
+	/* but it can be spliced out of */
+	pos = 0;
+	ret = splice(memfd, &pos, pipefd[1], NULL, 12, 0);
+	ASSERT_RETURN(ret == 12);
+	ASSERT_RETURN(read(pipefd[0], buf, 12) == 12);
+	ASSERT_RETURN(memcmp(buf, "kdbus splice", 12) == 0);
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+	close(memfd);
+
+	return CHECK_OK;
+}
+
+static int check_memfd_prealloc(struct kdbus_check_env *env)
+{
+	struct kdbus_cmd_memfd_prealloc cmd = {};
+	uint64_t size;
+	int memfd;
+	int ret;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MEMFD_NEW, &memfd);
+	ASSERT_RETURN(ret == 0);
+
+	/* preallocating extends the file */
+	cmd.size = 1024 * 1024;
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_PREALLOC, &cmd);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SIZE_GET, &size);
+	ASSERT_RETURN(ret == 0 && size == 1024 * 1024);
+
+	/* unless it is asked not to */
+	cmd.flags = KDBUS_MEMFD_PREALLOC_KEEP_SIZE;
+	cmd.size = 2 * 1024 * 1024;
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_PREALLOC, &cmd);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SIZE_GET, &size);
+	ASSERT_RETURN(ret == 0 && size == 1024 * 1024);
+
+	/* a sealed memfd can not be changed */
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SEAL_SET, 1);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_PREALLOC, &cmd);
+	ASSERT_RETURN(ret == -1 && errno == EPERM);
+
+	close(memfd);
+
+	return CHECK_OK;
+}
+
+static int check_memfd_unseal(struct kdbus_check_env *env)
+{
+	struct {
+		struct kdbus_msg msg;
+		struct kdbus_item item;
+	} __attribute__ ((__aligned__(8))) m = {};
+	int memfd;
+	int ret;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MEMFD_NEW, &memfd);
+	ASSERT_RETURN(ret == 0);
+
+	ASSERT_RETURN(write(memfd, "kdbus memfd 1234567", 19) == 19);
+
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SEAL_SET, 1);
+	ASSERT_RETURN(ret == 0);
+
+	/* a unicast message which never gets queued */
+	m.msg.size = sizeof(struct kdbus_msg) +
+		     KDBUS_ITEM_SIZE(sizeof(struct kdbus_memfd));
+	m.msg.payload_type = KDBUS_PAYLOAD_DBUS;
+	m.msg.src_id = env->conn->hello.id;
+	m.msg.dst_id = 0x12345678;
+	m.msg.cookie = 0xf00;
+	m.item.type = KDBUS_ITEM_PAYLOAD_MEMFD;
+	m.item.size = KDBUS_ITEM_HEADER_SIZE + sizeof(struct kdbus_memfd);
+	m.item.memfd.size = 19;
+	m.item.memfd.fd = memfd;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_SEND, &m);
+	ASSERT_RETURN(ret < 0 && errno == ENXIO);
+
+	/* the sender still owns the memfd alone and can reuse it */
+	ret = ioctl(memfd, KDBUS_CMD_MEMFD_SEAL_SET, 0);
+	ASSERT_RETURN(ret == 0);
+
+	ASSERT_RETURN(write(memfd, "x", 1) == 1);
+
+	close(memfd);
+
+	return CHECK_OK;
+}
+
+struct kdbus_test_ring {
+	struct kdbus_ring_header *hdr;
+	struct kdbus_ring_sqe *sqes;
+	struct kdbus_ring_cqe *cqes;
+	size_t size;
+};
+
+static int ring_setup(struct kdbus_conn *conn, uint64_t sq_entries,
+		      uint64_t cq_entries, struct kdbus_test_ring *ring)
+{
+	struct kdbus_cmd_ring cmd = {};
+	void *p;
+	int ret;
+
+	cmd.sq_entries = sq_entries;
+	cmd.cq_entries = cq_entries;
+	ret = ioctl(conn->fd, KDBUS_CMD_RING_SETUP, &cmd);
+	ASSERT_RETURN(ret == 0);
+
+	/* the sizes are rounded up to a power of two */
+	ASSERT_RETURN(cmd.sq_entries >= sq_entries);
+	ASSERT_RETURN((cmd.sq_entries & (cmd.sq_entries - 1)) == 0);
+
+	p = mmap(NULL, cmd.size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		 conn->fd, KDBUS_MMAP_OFF_RING);
+	ASSERT_RETURN(p != MAP_FAILED);
+
+	ring->hdr = p;
+	ring->sqes = (struct kdbus_ring_sqe *)((uint8_t *)p + ring->hdr->sq_offset);
+	ring->cqes = (struct kdbus_ring_cqe *)((uint8_t *)p + ring->hdr->cq_offset);
+	ring->size = cmd.size;
+
+	ASSERT_RETURN(ring->hdr->sq_entries == cmd.sq_entries);
+	ASSERT_RETURN(ring->hdr->cq_entries == cmd.cq_entries);
+
+	return 0;
+}
+
+static void ring_post(struct kdbus_test_ring *ring, uint64_t opcode,
+		      uint64_t user_data, uint64_t arg)
+{
+	struct kdbus_ring_sqe *sqe;
+
+	sqe = &ring->sqes[ring->hdr->sq_tail & (ring->hdr->sq_entries - 1)];
+	sqe->opcode = opcode;
+	sqe->flags = 0;
+	sqe->user_data = user_data;
+	sqe->arg = arg;
+
+	__sync_synchronize();
+	ring->hdr->sq_tail++;
+}
+
+/* take the next completion, NULL if there is none */
+static struct kdbus_ring_cqe *ring_next(struct kdbus_test_ring *ring)
+{
+	struct kdbus_ring_cqe *cqe;
+
+	if (ring->hdr->cq_head == ring->hdr->cq_tail)
+		return NULL;
+
+	cqe = &ring->cqes[ring->hdr->cq_head & (ring->hdr->cq_entries - 1)];
+	ring->hdr->cq_head++;
+
+	return cqe;
+}
+
+static int check_msg_ring(struct kdbus_check_env *env)
+{
+	struct kdbus_msg msg __attribute__ ((__aligned__(8))) = {};
+	struct kdbus_cmd_ring_enter enter = {};
+	struct kdbus_test_ring ring, sring;
+	struct kdbus_cmd_ring cmd = {};
+	struct kdbus_ring_cqe *cqe;
+	struct kdbus_conn *conn;
+	struct kdbus_msg *m;
+	unsigned int i;
+	uint64_t off;
+	int ret;
+
+	/* nothing to enter before the rings are set up */
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret < 0 && errno == ENXIO);
+
+	ret = ring_setup(env->conn, 3, 4, &ring);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(ring.hdr->sq_entries == 4);
+
+	/* the rings are set up only once */
+	cmd.sq_entries = 4;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_SETUP, &cmd);
+	ASSERT_RETURN(ret < 0 && errno == EEXIST);
+
+	/* a send-only connection can submit through rings as well */
+	conn = __make_conn(env->buspath, 0, 0, KDBUS_HELLO_SEND_ONLY);
+	ASSERT_RETURN(conn != NULL);
+
+	ret = ring_setup(conn, 4, 0, &sring);
+	ASSERT_RETURN(ret == 0);
+
+	msg.size = sizeof(msg);
+	msg.payload_type = KDBUS_PAYLOAD_DBUS;
+	msg.src_id = conn->hello.id;
+	msg.dst_id = env->conn->hello.id;
+	msg.cookie = 0xfeed;
+
+	ring_post(&sring, KDBUS_RING_OP_MSG_SEND, 1, (uint64_t)&msg);
+	ring_post(&sring, KDBUS_RING_OP_MSG_RECV, 2, 0);
+	ret = ioctl(conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret == 0 && enter.submitted == 2);
+	ASSERT_RETURN(sring.hdr->sq_head == 2);
+
+	cqe = ring_next(&sring);
+	ASSERT_RETURN(cqe && cqe->user_data == 1 && cqe->result == 0);
+
+	/* but it has nothing to receive into */
+	cqe = ring_next(&sring);
+	ASSERT_RETURN(cqe && cqe->user_data == 2 &&
+		      cqe->result == -EOPNOTSUPP);
+	ASSERT_RETURN(ring_next(&sring) == NULL);
+
+	/* receive the message, then an empty queue is reported */
+	ring_post(&ring, KDBUS_RING_OP_MSG_RECV, 3, 0);
+	ring_post(&ring, KDBUS_RING_OP_MSG_RECV, 4, 0);
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret == 0 && enter.submitted == 2);
+
+	cqe = ring_next(&ring);
+	ASSERT_RETURN(cqe && cqe->user_data == 3 && cqe->result == 0);
+	off = cqe->offset;
+
+	m = (struct kdbus_msg *)(env->conn->buf + off);
+	ASSERT_RETURN(m->cookie == 0xfeed);
+	ASSERT_RETURN(m->src_id == conn->hello.id);
+
+	cqe = ring_next(&ring);
+	ASSERT_RETURN(cqe && cqe->user_data == 4 && cqe->result == -EAGAIN);
+
+	/* the message is freed once, and only once */
+	ring_post(&ring, KDBUS_RING_OP_FREE, 5, off);
+	ring_post(&ring, KDBUS_RING_OP_FREE, 6, off);
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret == 0 && enter.submitted == 2);
+
+	cqe = ring_next(&ring);
+	ASSERT_RETURN(cqe && cqe->user_data == 5 && cqe->result == 0);
+	cqe = ring_next(&ring);
+	ASSERT_RETURN(cqe && cqe->user_data == 6 && cqe->result < 0);
+	ASSERT_RETURN(ring_next(&ring) == NULL);
+
+	/* fill the completion ring, which is not consumed */
+	for (i = 0; i < ring.hdr->cq_entries; i++)
+		ring_post(&ring, KDBUS_RING_OP_NOP, 10 + i, 0);
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret == 0 && enter.submitted == ring.hdr->cq_entries);
+
+	/* nothing more fits */
+	ring_post(&ring, KDBUS_RING_OP_NOP, 20, 0);
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret < 0 && errno == EBUSY);
+
+	for (i = 0; i < ring.hdr->cq_entries; i++) {
+		cqe = ring_next(&ring);
+		ASSERT_RETURN(cqe && cqe->user_data == 10 + i &&
+			      cqe->result == 0);
+	}
+
+	/* the pending entry is carried out once there is room */
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret == 0 && enter.submitted == 1);
+	cqe = ring_next(&ring);
+	ASSERT_RETURN(cqe && cqe->user_data == 20 && cqe->result == 0);
+
+	/* a tail beyond the entries of the ring is refused */
+	ring.hdr->sq_tail = ring.hdr->sq_head + ring.hdr->sq_entries + 1;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_RING_ENTER, &enter);
+	ASSERT_RETURN(ret < 0 && errno == EINVAL);
+	ring.hdr->sq_tail = ring.hdr->sq_head;
+
+	munmap(sring.hdr, sring.size);
+	munmap(ring.hdr, ring.size);
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+static int check_conn_send_only(struct kdbus_check_env *env)
+{
+	struct kdbus_conn *conn;
+	struct kdbus_msg msg __attribute__ ((__aligned__(8))) = {};
+	struct kdbus_cmd_recv recv = {};
+	uint64_t cookie = 0xf00f;
+	struct kdbus_msg *m;
+	void *p;
+	int ret;
+
+	conn = __make_conn(env->buspath, 0, 0, KDBUS_HELLO_SEND_ONLY);
+	ASSERT_RETURN(conn != NULL);
+
+	/* sending works ... */
+	ret = send_message(conn, NULL, cookie, env->conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	m = (struct kdbus_msg *)(env->conn->buf + recv.offset);
+	ASSERT_RETURN(m->cookie == cookie);
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	/* ... but there is no pool to receive anything in */
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret < 0 && errno == EOPNOTSUPP);
+
+	p = mmap(NULL, POOL_SIZE, PROT_READ, MAP_SHARED, conn->fd, 0);
+	ASSERT_RETURN(p == MAP_FAILED);
+
+	/* a reply could not be received either */
+	msg.size = sizeof(msg);
+	msg.flags = KDBUS_MSG_FLAGS_EXPECT_REPLY;
+	msg.timeout_ns = 1000000000ULL;
+	msg.src_id = conn->hello.id;
+	msg.dst_id = env->conn->hello.id;
+	msg.payload_type = KDBUS_PAYLOAD_DBUS;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret < 0 && errno == EOPNOTSUPP);
+
+	/* the connection cannot be addressed */
+	msg.flags = 0;
+	msg.timeout_ns = 0;
+	msg.src_id = env->conn->hello.id;
+	msg.dst_id = conn->hello.id;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret < 0 && errno == ENXIO);
+
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+/* send to a connection until its queue or its pool takes nothing more */
+static int fill_conn(struct kdbus_conn *conn, uint64_t dst_id)
+{
+	struct kdbus_msg *msg;
+	uint64_t vec_size = 1024 * 1024;
+	unsigned int i;
+	uint64_t size;
+	char *buf;
+	int ret;
+
+	buf = calloc(1, vec_size);
+	ASSERT_RETURN(buf != NULL);
+
+	size = sizeof(struct kdbus_msg) +
+	       KDBUS_ITEM_SIZE(sizeof(struct kdbus_vec));
+	msg = malloc(size);
+	ASSERT_RETURN(msg != NULL);
+
+	/* halve the payload on every refusal, down to no payload at all */
+	for (i = 0; i < 4096; i++) {
+		memset(msg, 0, size);
+		msg->size = sizeof(struct kdbus_msg);
+		msg->src_id = conn->hello.id;
+		msg->dst_id = dst_id;
+		msg->cookie = 0x10000 + i;
+		msg->payload_type = KDBUS_PAYLOAD_DBUS;
+
+		if (vec_size > 0) {
+			msg->items->type = KDBUS_ITEM_PAYLOAD_VEC;
+			msg->items->size = KDBUS_ITEM_HEADER_SIZE +
+					   sizeof(struct kdbus_vec);
+			msg->items->vec.address = (uint64_t)buf;
+			msg->items->vec.size = vec_size;
+			msg->size = size;
+		}
+
+		ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, msg);
+		if (ret == 0)
+			continue;
+
+		ASSERT_RETURN(errno == EXFULL || errno == ENOBUFS);
+		if (vec_size == 0)
+			break;
+
+		vec_size /= 2;
+		if (vec_size < 8)
+			vec_size = 0;
+	}
+
+	free(msg);
+	free(buf);
+
+	ASSERT_RETURN(i < 4096);
+
+	return 0;
+}
+
+/* receive everything queued, count the replies from src_id to a cookie */
+static int recv_all(struct kdbus_conn *conn, uint64_t src_id,
+		    uint64_t cookie_reply, unsigned int *replies)
+{
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_msg *m;
+	int ret;
+
+	*replies = 0;
+
+	for (;;) {
+		ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+		if (ret < 0) {
+			ASSERT_RETURN(errno == EAGAIN);
+			break;
+		}
+
+		m = (struct kdbus_msg *)(conn->buf + recv.offset);
+		if (m->src_id == src_id && m->cookie_reply == cookie_reply)
+			(*replies)++;
+
+		ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+		ASSERT_RETURN(ret == 0);
+	}
+
+	return 0;
+}
+
+static int check_msg_reply_reserve(struct kdbus_check_env *env)
+{
+	struct kdbus_msg msg __attribute__ ((__aligned__(8))) = {};
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_conn *conn, *flood;
+	unsigned int replies;
+	struct kdbus_msg *m;
+	int ret;
+
+	/* create a 2nd connection to call, and a 3rd one to fill the caller */
+	conn = make_conn(env->buspath);
+	ASSERT_RETURN(conn != NULL);
+
+	flood = make_conn(env->buspath);
+	ASSERT_RETURN(flood != NULL);
+
+	msg.size = sizeof(msg);
+	msg.payload_type = KDBUS_PAYLOAD_DBUS;
+	msg.src_id = env->conn->hello.id;
+	msg.dst_id = conn->hello.id;
+	msg.cookie = 0xcafe;
+
+	/* room is only reserved for calls with a timeout */
+	msg.flags = KDBUS_MSG_FLAGS_RESERVE_REPLY;
+	msg.timeout_ns = 1000000000ULL;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret < 0 && errno == EINVAL);
+
+	msg.flags = KDBUS_MSG_FLAGS_EXPECT_REPLY |
+		    KDBUS_MSG_FLAGS_RESERVE_REPLY;
+	msg.timeout_ns = 0;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret < 0 && errno == EINVAL);
+
+	msg.timeout_ns = 1000000000ULL;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret == 0);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret == 0);
+
+	m = (struct kdbus_msg *)(conn->buf + recv.offset);
+	ASSERT_RETURN(m->cookie == 0xcafe);
+
+	ret = ioctl(conn->fd, KDBUS_CMD_FREE, &recv.offset);
+	ASSERT_RETURN(ret == 0);
+
+	/* a reply cannot expect a reply itself */
+	msg.flags = KDBUS_MSG_FLAGS_REPLY | KDBUS_MSG_FLAGS_EXPECT_REPLY;
+	msg.src_id = conn->hello.id;
+	msg.dst_id = env->conn->hello.id;
+	msg.cookie = 0xbeef;
+	msg.cookie_reply = 0xcafe;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret < 0 && errno == EINVAL);
+
+	/* fill the caller, an unrelated message of the reply's size is refused */
+	ret = fill_conn(flood, env->conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+
+	msg.flags = 0;
+	msg.src_id = flood->hello.id;
+	msg.cookie = 0xdead;
+	msg.cookie_reply = 0;
+	ret = ioctl(flood->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret < 0 && (errno == EXFULL || errno == ENOBUFS));
+
+	/* the reply still goes into the room kept for it */
+	msg.flags = KDBUS_MSG_FLAGS_REPLY;
+	msg.src_id = conn->hello.id;
+	msg.cookie = 0xbeef;
+	msg.cookie_reply = 0xcafe;
+	ret = ioctl(conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret == 0);
+
+	ret = recv_all(env->conn, conn->hello.id, 0xcafe, &replies);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(replies == 1);
+
+	free_conn(flood);
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+static int check_msg_reply_reserve_timeout(struct kdbus_check_env *env)
+{
+	struct kdbus_msg msg __attribute__ ((__aligned__(8))) = {};
+	struct kdbus_conn *conn, *flood;
+	unsigned int replies;
+	int ret;
+
+	/* a callee which never looks at the call, and a 3rd connection */
+	conn = make_conn(env->buspath);
+	ASSERT_RETURN(conn != NULL);
+
+	flood = make_conn(env->buspath);
+	ASSERT_RETURN(flood != NULL);
+
+	msg.size = sizeof(msg);
+	msg.payload_type = KDBUS_PAYLOAD_DBUS;
+	msg.src_id = env->conn->hello.id;
+	msg.dst_id = conn->hello.id;
+	msg.cookie = 0xcafe;
+	msg.flags = KDBUS_MSG_FLAGS_EXPECT_REPLY |
+		    KDBUS_MSG_FLAGS_RESERVE_REPLY;
+	msg.timeout_ns = 100 * 1000 * 1000ULL;
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_SEND, &msg);
+	ASSERT_RETURN(ret == 0);
+
+	ret = fill_conn(flood, env->conn->hello.id);
+	ASSERT_RETURN(ret == 0);
+
+	/*
+	 * The call expires in the callee's queue at its deadline, the
+	 * room kept in the full caller outlives it for the REPLY_TIMEOUT.
+	 */
+	usleep(300 * 1000);
+
+	ret = recv_all(env->conn, KDBUS_SRC_ID_KERNEL, 0xcafe, &replies);
+	ASSERT_RETURN(ret == 0);
+	ASSERT_RETURN(replies == 1);
+
+	free_conn(flood);
+	free_conn(conn);
+
+	return CHECK_OK;
+}
+
+static int check_bus_teardown(struct kdbus_check_env *env)
+{
+	struct kdbus_cmd_hello hello __attribute__ ((__aligned__(8))) = {};
+	struct kdbus_cmd_name *cmd_name;
+	struct kdbus_cmd_recv recv = {};
+	struct kdbus_conn *conn;
+	struct pollfd fd;
+	uint64_t size;
+	char *name;
+	int ep_fd;
+	int ret;
+
+	name = "foo.bar.teardown";
+
+	/* create a 2nd connection which owns a name */
+	conn = make_conn(env->buspath);
+	ASSERT_RETURN(conn != NULL);
+
+	ret = upload_policy(conn->fd, name);
+	ASSERT_RETURN(ret == 0);
+
+	size = sizeof(*cmd_name) + strlen(name) + 1;
+	cmd_name = alloca(size);
+
+	memset(cmd_name, 0, size);
+	strcpy(cmd_name->name, name);
+	cmd_name->size = size;
+
+	ret = ioctl(conn->fd, KDBUS_CMD_NAME_ACQUIRE, cmd_name);
+	ASSERT_RETURN(ret == 0);
+
+	/* the 1st connection would see the name and the ID go away */
+	add_match_empty(env->conn->fd);
+
+	/* an endpoint file which has not said hello yet */
+	ep_fd = open(env->buspath, O_RDWR|O_CLOEXEC);
+	ASSERT_RETURN(ep_fd >= 0);
+
+	/* the bus goes away with its owner */
+	close(env->control_fd);
+	env->control_fd = -1;
+
+	free_conn(conn);
+
+	fd.fd = env->conn->fd;
+	fd.events = POLLIN | POLLPRI | POLLHUP;
+	fd.revents = 0;
+
+	ret = poll(&fd, 1, 100);
+	ASSERT_RETURN(ret > 0 && (fd.revents & POLLHUP));
+
+	/* the torn down connection takes no commands anymore */
+	ret = ioctl(env->conn->fd, KDBUS_CMD_MSG_RECV, &recv);
+	ASSERT_RETURN(ret < 0 && errno == ECONNRESET);
+
+	memset(cmd_name, 0, size);
+	strcpy(cmd_name->name, name);
+	cmd_name->size = size;
+
+	ret = ioctl(env->conn->fd, KDBUS_CMD_NAME_ACQUIRE, cmd_name);
+	ASSERT_RETURN(ret < 0 && errno == ECONNRESET);
+
+	/* and no new connection can join it */
+	hello.size = sizeof(hello);
+	hello.pool_size = POOL_SIZE;
+	ret = ioctl(ep_fd, KDBUS_CMD_HELLO, &hello);
+	ASSERT_RETURN(ret < 0 && errno == ESHUTDOWN);
+
+	close(ep_fd);
+
+	return CHECK_OK;
+}
+
 static int check_msg_free(struct kdbus_check_env *env)
 {
 	int ret;
@@ -637,6 +1684,9 @@ static int check_prepare_env(const struct kdbus_check *c, struct kdbus_check_env
 		memset(&bus_make, 0, sizeof(bus_make));
 		bus_make.head.bloom_size = 64;
 
+		if (c->flags & CHECK_NAME_DIRECTORY)
+			bus_make.head.flags |= KDBUS_MAKE_NAME_DIRECTORY;
+
 		for (i = 0; i < sizeof(n); i++)
 			n[i] = 'a' + (random() % ('z' - 'a'));
 
@@ -688,8 +1738,22 @@ static const struct kdbus_check checks[] = {
 	{ "name basics",	check_name_basic,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
 	{ "name conflict",	check_name_conflict,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
 	{ "name queue",		check_name_queue,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "name directory",	check_name_directory,	CHECK_CREATE_BUS | CHECK_CREATE_CONN | CHECK_NAME_DIRECTORY },
 	{ "message basic",	check_msg_basic,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
 	{ "message free",	check_msg_free,		CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message lazy fds",	check_msg_lazy_fds,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message memfd inline",	check_msg_memfd_inline,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message broadcast memfd",	check_msg_broadcast_memfd, CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message vec memfd",		check_msg_vec_memfd,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "memfd splice",		check_memfd_splice,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "memfd prealloc",		check_memfd_prealloc,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "memfd unseal",		check_memfd_unseal,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message busy poll",	check_msg_busy_poll,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message ring",	check_msg_ring,		CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "send-only connection",	check_conn_send_only,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message reply reserve",	check_msg_reply_reserve, CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "message reply timeout",	check_msg_reply_reserve_timeout, CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
+	{ "bus teardown",	check_bus_teardown,	CHECK_CREATE_BUS | CHECK_CREATE_CONN	},
 	{ "ns make",		check_nsmake,		0					},
 	{ NULL, NULL, 0 }
 };